@@ -0,0 +1,286 @@
+#include "bvh.h"
+#include <algorithm>
+#include <cmath>
+#include "morton.h"
+#include "threadpool.h"
+
+struct BVHSubtree
+{
+	size_t node, lo, hi;
+};
+
+static void ListSubtrees(size_t node, size_t lo, size_t hi, int depth, int target,
+			 std::vector<BVHSubtree>& out)
+{
+	if(depth == target)
+	{
+		out.push_back(BVHSubtree{node, lo, hi});
+		return;
+	}
+	size_t mid = lo + (hi - lo) / 2;
+	ListSubtrees(2 * node + 1, lo, mid, depth + 1, target, out);
+	ListSubtrees(2 * node + 2, mid, hi, depth + 1, target, out);
+}
+
+PointBVH::PointBVH(const char* name) :
+	m_depth(0),
+	m_mem(name)
+{
+}
+
+void PointBVH::Build(const Vertex* verts, size_t count, ThreadPool* pPool, const char* skip)
+{
+	std::vector<vmath::vec3> points;
+	std::vector<uint32_t> kept;
+	points.reserve(count);
+	for(size_t i = 0; i < count; ++i)
+	{
+		if(skip && skip[i])
+		{
+			continue;
+		}
+		points.push_back(vmath::vec3(verts[i].vertex[0], verts[i].vertex[1], verts[i].vertex[2]));
+		kept.push_back(i);
+	}
+	count = points.size();
+	MortonOrder(count ? &points[0] : 0, count, m_order, pPool);
+	for(uint32_t& idx : m_order)
+	{
+		idx = kept[idx];
+	}
+
+	m_depth = 0;
+	while(((count + (1ul << m_depth) - 1) >> m_depth) > BVH_LEAF_SIZE)
+	{
+		++m_depth;
+	}
+
+	m_x.resize(count);
+	m_y.resize(count);
+	m_z.resize(count);
+	m_bounds.resize((2ul << m_depth) - 1);
+	m_mem.SetCPU(m_order.capacity() * sizeof(uint32_t) +
+		     (m_x.capacity() + m_y.capacity() + m_z.capacity()) * sizeof(float) +
+		     m_bounds.capacity() * sizeof(Bounds));
+	Refit(verts, pPool);
+}
+
+void PointBVH::Refit(const Vertex* verts, ThreadPool* pPool)
+{
+	size_t count = m_order.size();
+	const int leaflevel = m_depth;
+
+	//Each subtree gathers its points into tree order and boxes its leaves
+	//and nodes; the levels above them are joined afterwards
+	auto refitsubtree = [this, verts, leaflevel](const BVHSubtree& sub, int depth)
+	{
+		for(size_t i = sub.lo; i < sub.hi; ++i)
+		{
+			const vmath::vec4& v = verts[m_order[i]].vertex;
+			m_x[i] = v[0];
+			m_y[i] = v[1];
+			m_z[i] = v[2];
+		}
+		std::vector<BVHSubtree> leaves;
+		ListSubtrees(sub.node, sub.lo, sub.hi, depth, leaflevel, leaves);
+		for(const BVHSubtree& leaf : leaves)
+		{
+			Bounds& box = m_bounds[leaf.node];
+			box.min[0] = box.min[1] = box.min[2] = INFINITY;
+			box.max[0] = box.max[1] = box.max[2] = -INFINITY;
+			for(size_t i = leaf.lo; i < leaf.hi; ++i)
+			{
+				box.min[0] = std::min(box.min[0], m_x[i]);
+				box.min[1] = std::min(box.min[1], m_y[i]);
+				box.min[2] = std::min(box.min[2], m_z[i]);
+				box.max[0] = std::max(box.max[0], m_x[i]);
+				box.max[1] = std::max(box.max[1], m_y[i]);
+				box.max[2] = std::max(box.max[2], m_z[i]);
+			}
+		}
+		//Parents in the subtree bottom up, level by level
+		for(int level = leaflevel - 1; level >= depth; --level)
+		{
+			size_t span = 1ul << (level - depth);
+			size_t first = ((sub.node + 1) << (level - depth)) - 1;
+			for(size_t node = first; node < first + span; ++node)
+			{
+				Bounds& box = m_bounds[node];
+				const Bounds& a = m_bounds[2 * node + 1];
+				const Bounds& b = m_bounds[2 * node + 2];
+				for(int d = 0; d < 3; ++d)
+				{
+					box.min[d] = std::min(a.min[d], b.min[d]);
+					box.max[d] = std::max(a.max[d], b.max[d]);
+				}
+			}
+		}
+	};
+
+	int splitdepth = 0;
+	if(pPool)
+	{
+		while((1u << splitdepth) < 4 * pPool->GetThreadCount() && splitdepth < m_depth)
+		{
+			++splitdepth;
+		}
+	}
+	std::vector<BVHSubtree> subtrees;
+	ListSubtrees(0, 0, count, 0, splitdepth, subtrees);
+	if(pPool)
+	{
+		pPool->ParallelFor(0, subtrees.size(), 1,
+				   [&subtrees, &refitsubtree, splitdepth](size_t first, size_t last)
+				   {
+					   for(size_t i = first; i < last; ++i)
+					   {
+						   refitsubtree(subtrees[i], splitdepth);
+					   }
+				   });
+	}
+	else
+	{
+		refitsubtree(subtrees[0], 0);
+	}
+
+	for(int level = splitdepth - 1; level >= 0; --level)
+	{
+		for(size_t node = (1ul << level) - 1; node < (2ul << level) - 1; ++node)
+		{
+			Bounds& box = m_bounds[node];
+			const Bounds& a = m_bounds[2 * node + 1];
+			const Bounds& b = m_bounds[2 * node + 2];
+			for(int d = 0; d < 3; ++d)
+			{
+				box.min[d] = std::min(a.min[d], b.min[d]);
+				box.max[d] = std::max(a.max[d], b.max[d]);
+			}
+		}
+	}
+}
+
+uint32_t PointBVH::Pick(const vmath::vec3& origin, const vmath::vec3& dir, float spread,
+			float* pt) const
+{
+	uint32_t best = BVH_NO_HIT;
+	float bestt = INFINITY;
+	if(m_order.empty())
+	{
+		return best;
+	}
+
+	//Where the ray enters the box grown by the cone's width at the box's
+	//far end, or false if it misses or only enters beyond the best hit
+	auto enter = [this, &origin, &dir, spread, &bestt](size_t node, float* ptenter)
+	{
+		const Bounds& box = m_bounds[node];
+		float tfar = 0.f;
+		for(int d = 0; d < 3; ++d)
+		{
+			tfar += std::max(dir[d] * (box.min[d] - origin[d]), dir[d] * (box.max[d] - origin[d]));
+		}
+		if(!(tfar > 0.f))
+		{
+			return false;
+		}
+		float grow = spread * tfar * 1.0001f;
+		float t0 = 0.f, t1 = bestt;
+		for(int d = 0; d < 3; ++d)
+		{
+			float lo = box.min[d] - grow - origin[d], hi = box.max[d] + grow - origin[d];
+			if(dir[d] == 0.f)
+			{
+				if(lo > 0.f || hi < 0.f)
+				{
+					return false;
+				}
+				continue;
+			}
+			float ta = lo / dir[d], tb = hi / dir[d];
+			t0 = std::max(t0, std::min(ta, tb));
+			t1 = std::min(t1, std::max(ta, tb));
+			if(t0 > t1)
+			{
+				return false;
+			}
+		}
+		*ptenter = t0;
+		return true;
+	};
+
+	struct Entry
+	{
+		size_t node, lo, hi;
+		int depth;
+		float t;
+	};
+	Entry stack[2 * 64];
+	int top = 0;
+	float t;
+	if(enter(0, &t))
+	{
+		stack[top++] = Entry{0, 0, m_order.size(), 0, t};
+	}
+
+	const float spread2 = spread * spread;
+	while(top > 0)
+	{
+		Entry e = stack[--top];
+		if(e.t > bestt)
+		{
+			continue;
+		}
+
+		if(e.depth == m_depth)
+		{
+			for(size_t i = e.lo; i < e.hi; ++i)
+			{
+				float dx = m_x[i] - origin[0], dy = m_y[i] - origin[1], dz = m_z[i] - origin[2];
+				float along = dx * dir[0] + dy * dir[1] + dz * dir[2];
+				if(!(along > 0.f) || along > bestt)
+				{
+					continue;
+				}
+				float off2 = dx * dx + dy * dy + dz * dz - along * along;
+				if(off2 <= spread2 * along * along &&
+				   (along < bestt || m_order[i] < best))
+				{
+					bestt = along;
+					best = m_order[i];
+				}
+			}
+			continue;
+		}
+
+		//Nearer child on top of the stack
+		size_t mid = e.lo + (e.hi - e.lo) / 2;
+		size_t left = 2 * e.node + 1, right = 2 * e.node + 2;
+		float tleft = INFINITY, tright = INFINITY;
+		bool bLeft = enter(left, &tleft), bRight = enter(right, &tright);
+		Entry near = Entry{left, e.lo, mid, e.depth + 1, tleft};
+		Entry far = Entry{right, mid, e.hi, e.depth + 1, tright};
+		if(bLeft && bRight)
+		{
+			if(tright < tleft)
+			{
+				std::swap(near, far);
+			}
+			stack[top++] = far;
+			stack[top++] = near;
+		}
+		else if(bLeft)
+		{
+			stack[top++] = near;
+		}
+		else if(bRight)
+		{
+			stack[top++] = far;
+		}
+	}
+
+	if(pt)
+	{
+		*pt = bestt;
+	}
+	return best;
+}
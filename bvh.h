@@ -0,0 +1,55 @@
+#ifndef BVH_H_
+#define BVH_H_
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "vmath.h"
+#include "vertex.h"
+#include "memstats.h"
+
+#define BVH_LEAF_SIZE 16
+#define BVH_NO_HIT 0xFFFFFFFFu
+
+class ThreadPool;
+
+//Bounding volume hierarchy over the points of a vertex array, for ray
+//picking. Points are ordered along a Z-order curve and split in halves
+//down to buckets of BVH_LEAF_SIZE, giving an implicit tree (node i has
+//children 2i+1 and 2i+2) whose shape only depends on the point count.
+//Moving points keep their place in the tree: Refit recomputes the boxes
+//from the new positions, which is far cheaper than a rebuild but lets the
+//boxes grow looser as points drift.
+class PointBVH
+{
+public:
+	PointBVH(const char* name);
+
+	//Vertices whose skip flag is set, when skip is given, are left out
+	void Build(const Vertex* verts, size_t count, ThreadPool* pPool = 0, const char* skip = 0);
+	void Refit(const Vertex* verts, ThreadPool* pPool = 0);
+
+	size_t Size() const
+	{
+		return m_order.size();
+	}
+
+	//Point hit first by a ray from origin along the unit vector dir, where
+	//a point counts as hit when it lies within spread * t of the ray at
+	//distance t along it, a cone of constant screen size. Returns the
+	//vertex index or BVH_NO_HIT, with the distance along the ray in *pt.
+	uint32_t Pick(const vmath::vec3& origin, const vmath::vec3& dir, float spread,
+		      float* pt = 0) const;
+private:
+	struct Bounds
+	{
+		float min[3], max[3];
+	};
+
+	std::vector<uint32_t> m_order; //Vertex index of each tree position
+	std::vector<float> m_x, m_y, m_z; //Positions in tree order
+	std::vector<Bounds> m_bounds;
+	int m_depth;
+	MemCounter m_mem;
+};
+
+#endif
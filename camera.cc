@@ -69,3 +69,18 @@ void Camera::LookAtTarget()
 	m_left = vmath::normalize(vmath::cross(m_pinnedup, m_forward));
 	m_up = vmath::normalize(vmath::cross(m_forward, m_left));
 }
+
+void Camera::GetPickRay(float x, float y, vmath::vec3* pOrigin, vmath::vec3* pDir) const
+{
+	//Undo the perspective scale onto the z = -1 plane of view space, then
+	//rotate back by the transpose of the view's rotation; both are exact
+	//inverses, no general 4x4 inverse is needed
+	float vx = x / m_proj[0][0], vy = y / m_proj[1][1], vz = -1.f;
+	vmath::vec3 dir;
+	for(int i = 0; i < 3; ++i)
+	{
+		dir[i] = m_view[i][0] * vx + m_view[i][1] * vy + m_view[i][2] * vz;
+	}
+	*pOrigin = m_eye;
+	*pDir = vmath::normalize(dir);
+}
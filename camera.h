@@ -29,6 +29,11 @@ public:
 		m_up = up;
 	}
 
+	const vmath::vec3& GetPosition() const
+	{
+		return m_eye;
+	}
+
 	vmath::vec3 GetUpVector()
 	{
 		return m_up;
@@ -47,6 +52,16 @@ public:
 		return m_proj;
 	}
 
+	//World space ray from the eye through normalised device coordinates
+	//(x, y); pDir receives a unit vector
+	void GetPickRay(float x, float y, vmath::vec3* pOrigin, vmath::vec3* pDir) const;
+
+	//Width of one pixel at unit distance in front of the eye
+	float GetPixelSpread(int viewportheight) const
+	{
+		return 2.f / (viewportheight * m_proj[1][1]);
+	}
+
 	vmath::vec3& GetVelocity()
 	{
 		return m_velocity;
@@ -0,0 +1,226 @@
+#include "cluster.h"
+#include "graph.h"
+#include <algorithm>
+#include <cmath>
+
+ClusterTree::ClusterTree() :
+	m_nodecount(0),
+	m_mem("Cluster tree")
+{
+}
+
+static uint32_t FindSet(std::vector<uint32_t>& parent, uint32_t x)
+{
+	while(parent[x] != x)
+	{
+		parent[x] = parent[parent[x]];
+		x = parent[x];
+	}
+	return x;
+}
+
+void ClusterTree::Build(const Graph& graph)
+{
+	size_t n = graph.GetNodeCount();
+	const std::vector<Edge>& edges = graph.GetEdges();
+	m_nodecount = n;
+	m_merges.clear();
+	m_roots.clear();
+	m_order.assign(n, 0);
+
+	//Kruskal order, ties broken by endpoints so the tree is deterministic
+	std::vector<float> length2(edges.size());
+	std::vector<uint32_t> sorted(edges.size());
+	for(size_t i = 0; i < edges.size(); ++i)
+	{
+		vmath::vec3 d = graph.GetPosition(edges[i].i0) - graph.GetPosition(edges[i].i1);
+		length2[i] = vmath::dot(d, d);
+		sorted[i] = i;
+	}
+	std::sort(sorted.begin(), sorted.end(),
+		  [&edges, &length2](uint32_t a, uint32_t b)
+		  {
+			  if(length2[a] != length2[b])
+			  {
+				  return length2[a] < length2[b];
+			  }
+			  uint32_t alo = std::min(edges[a].i0, edges[a].i1);
+			  uint32_t blo = std::min(edges[b].i0, edges[b].i1);
+			  if(alo != blo)
+			  {
+				  return alo < blo;
+			  }
+			  return std::max(edges[a].i0, edges[a].i1) < std::max(edges[b].i0, edges[b].i1);
+		  });
+
+	//Union-find over the nodes, each set remembering the cluster it forms
+	std::vector<uint32_t> parent(n), cluster(n), size(n, 1);
+	for(size_t i = 0; i < n; ++i)
+	{
+		parent[i] = i;
+		cluster[i] = i;
+	}
+	auto sphere = [this, &graph](uint32_t c, float* pc, float* pr)
+	{
+		if(c < m_nodecount)
+		{
+			vmath::vec3 v = graph.GetPosition(c);
+			pc[0] = v[0];
+			pc[1] = v[1];
+			pc[2] = v[2];
+			*pr = 0.f;
+			return;
+		}
+		const Merge& m = m_merges[c - m_nodecount];
+		pc[0] = m.x;
+		pc[1] = m.y;
+		pc[2] = m.z;
+		*pr = m.radius;
+	};
+
+	for(uint32_t e : sorted)
+	{
+		uint32_t a = FindSet(parent, edges[e].i0), b = FindSet(parent, edges[e].i1);
+		if(a == b)
+		{
+			continue;
+		}
+		if(size[a] < size[b])
+		{
+			std::swap(a, b);
+		}
+
+		Merge m;
+		m.child[0] = cluster[a];
+		m.child[1] = cluster[b];
+		m.i0 = edges[e].i0;
+		m.i1 = edges[e].i1;
+		m.rep = m.child[0] < n ? m.child[0] : m_merges[m.child[0] - n].rep;
+		m.first = 0;
+
+		//Smallest sphere around both child spheres
+		float ca[3], cb[3], ra, rb;
+		sphere(m.child[0], ca, &ra);
+		sphere(m.child[1], cb, &rb);
+		float dx = cb[0] - ca[0], dy = cb[1] - ca[1], dz = cb[2] - ca[2];
+		float d = sqrtf(dx * dx + dy * dy + dz * dz);
+		if(d + rb <= ra)
+		{
+			m.x = ca[0];
+			m.y = ca[1];
+			m.z = ca[2];
+			m.radius = ra;
+		}
+		else if(d + ra <= rb)
+		{
+			m.x = cb[0];
+			m.y = cb[1];
+			m.z = cb[2];
+			m.radius = rb;
+		}
+		else
+		{
+			m.radius = (d + ra + rb) * 0.5f;
+			float t = (m.radius - ra) / d;
+			m.x = ca[0] + dx * t;
+			m.y = ca[1] + dy * t;
+			m.z = ca[2] + dz * t;
+		}
+
+		parent[b] = a;
+		size[a] += size[b];
+		cluster[a] = n + m_merges.size();
+		m_merges.push_back(m);
+	}
+
+	//Roots are the final cluster of every set that merged at all
+	for(size_t i = 0; i < n; ++i)
+	{
+		if(parent[i] == i && size[i] > 1)
+		{
+			m_roots.push_back(cluster[i]);
+		}
+	}
+
+	//Number the nodes depth first, first child first
+	uint32_t next = 0;
+	for(uint32_t root : m_roots)
+	{
+		m_stack.assign(1, root);
+		while(!m_stack.empty())
+		{
+			uint32_t c = m_stack.back();
+			m_stack.pop_back();
+			if(c < n)
+			{
+				m_order[c] = next++;
+				continue;
+			}
+			Merge& m = m_merges[c - n];
+			m.first = next;
+			m_stack.push_back(m.child[1]);
+			m_stack.push_back(m.child[0]);
+		}
+	}
+	UpdateMemory();
+}
+
+size_t ClusterTree::Cut(const vmath::vec3& eye, float detail, std::vector<uint32_t>& indices)
+{
+	indices.clear();
+	m_cutfirst.clear();
+	m_cutrep.clear();
+	m_open.clear();
+
+	//Walking depth first, first child first, lists the cut in m_order
+	float detail2 = detail * detail;
+	for(uint32_t root : m_roots)
+	{
+		m_stack.assign(1, root);
+		while(!m_stack.empty())
+		{
+			uint32_t c = m_stack.back();
+			m_stack.pop_back();
+			if(c < m_nodecount)
+			{
+				m_cutfirst.push_back(m_order[c]);
+				m_cutrep.push_back(c);
+				continue;
+			}
+			const Merge& m = m_merges[c - m_nodecount];
+			float dx = m.x - eye[0], dy = m.y - eye[1], dz = m.z - eye[2];
+			if(m.radius * m.radius <= detail2 * (dx * dx + dy * dy + dz * dz))
+			{
+				m_cutfirst.push_back(m.first);
+				m_cutrep.push_back(m.rep);
+				continue;
+			}
+			m_open.push_back(c - m_nodecount);
+			m_stack.push_back(m.child[1]);
+			m_stack.push_back(m.child[0]);
+		}
+	}
+
+	auto rep = [this](uint32_t node)
+	{
+		size_t i = std::upper_bound(m_cutfirst.begin(), m_cutfirst.end(), m_order[node]) -
+			m_cutfirst.begin() - 1;
+		return m_cutrep[i];
+	};
+	indices.reserve(m_open.size() * 2);
+	for(uint32_t i : m_open)
+	{
+		indices.push_back(rep(m_merges[i].i0));
+		indices.push_back(rep(m_merges[i].i1));
+	}
+	UpdateMemory();
+	return m_cutfirst.size();
+}
+
+void ClusterTree::UpdateMemory()
+{
+	m_mem.SetCPU(m_merges.capacity() * sizeof(Merge) +
+		     (m_roots.capacity() + m_order.capacity() + m_stack.capacity() +
+		      m_cutfirst.capacity() + m_cutrep.capacity() + m_open.capacity()) *
+		     sizeof(uint32_t));
+}
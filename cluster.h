@@ -0,0 +1,64 @@
+#ifndef CLUSTER_H_
+#define CLUSTER_H_
+#include <vector>
+#include <cstdint>
+#include "vmath.h"
+#include "memstats.h"
+
+class Graph;
+
+//Single-linkage dendrogram over a Graph, built by Kruskal's algorithm on its
+//edges: every merge joins two clusters through the shortest edge between
+//them. Over the MST, or any graph containing it such as the Gabriel or
+//relative-neighbourhood graph, this is the exact single-linkage hierarchy.
+//Clusters 0 .. n-1 are the nodes themselves; each merge adds one above them.
+//Merges and bounding spheres are copied out of the graph, so Build has to
+//run again once its edges or positions change; a stale tree cuts to the
+//old stars.
+class ClusterTree
+{
+public:
+	ClusterTree();
+
+	void Build(const Graph& graph);
+
+	bool IsBuilt() const
+	{
+		return m_nodecount != 0;
+	}
+
+	//Level-of-detail cut for a viewer at eye. A cluster is opened while its
+	//bounding sphere subtends more than about detail radians, and every
+	//open cluster contributes the edge that formed it, drawn between the
+	//representative stars of the cut clusters holding its two endpoints.
+	//indices receives those edges as GL_LINES vertex pairs, one fewer than
+	//the clusters in the cut per tree, so fully opened it is the graph's
+	//spanning forest and far away a handful of lines. Returns the number of
+	//clusters in the cut.
+	size_t Cut(const vmath::vec3& eye, float detail, std::vector<uint32_t>& indices);
+private:
+	struct Merge
+	{
+		uint32_t child[2];
+		uint32_t i0, i1; //The edge that joined the children
+		uint32_t rep; //Star drawn for the cluster, taken from its larger child
+		uint32_t first; //Start of its nodes in m_order
+		float x, y, z, radius; //Bounding sphere
+	};
+
+	void UpdateMemory();
+
+	size_t m_nodecount;
+	std::vector<Merge> m_merges; //Cluster m_nodecount + i is m_merges[i]
+	std::vector<uint32_t> m_roots;
+	//Position of each node in a depth-first order of the tree, which puts
+	//every cluster's nodes in one run
+	std::vector<uint32_t> m_order;
+
+	//Cut scratch: the cut as runs of m_order with their representatives,
+	//in order, and the merges left open
+	std::vector<uint32_t> m_stack, m_cutfirst, m_cutrep, m_open;
+	MemCounter m_mem;
+};
+
+#endif
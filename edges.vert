@@ -0,0 +1,14 @@
+#version 400
+
+layout(location = 0) in vec4 vp;
+layout(location = 1) in vec4 incol;
+
+uniform mat4x4 projviewmodelMat;
+out vec4 color;
+
+void main()
+{
+	//Edges share the stars' vertices but are drawn in a flat grey
+	gl_Position =  projviewmodelMat * vp;
+	color = vec4(0.5, 0.5, 0.5, 0.5);
+};
@@ -2,6 +2,7 @@
 #include <cstring>
 #include <cmath>
 #include <cstdio>
+#include <cstdlib>
 
 #include <algorithm>
 #include <vector>
@@ -21,6 +22,20 @@
 #include "object.h"
 #include "camera.h"
 #include "graph.h"
+#include "memstats.h"
+#include "randgen.h"
+#include "poisson.h"
+#include "threadpool.h"
+#include "route.h"
+#include "cluster.h"
+#include "morton.h"
+#include "bvh.h"
+#include "sap.h"
+#include "planetoid.h"
+#include "simthread.h"
+#include "nbody.h"
+#include "sector.h"
+#include "snapshot.h"
 
 constexpr float PI = 3.14159265358979f;
 
@@ -62,18 +77,564 @@ void printmat4(GLfloat* mat)
 	printf("\n");
 }
 
+float TimeDiffSecs(struct timespec *b, struct timespec *a)
+{
+	return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1000000000.0;
+}
+
+//Seed when none is given on the command line
+#define GLTEST_SEED 0xFeedFaceDeadBeefull
+
+RandGen g_randgen;
+
 struct Simulation
 {
 	Camera* pCamera;
 	Object* pStarsObj;
+	Object* pEdgesObj;
+	Graph* pGraph;
+	ThreadPool* pPool;
+	std::vector<unsigned int> spawned; //Stars added at runtime, newest last
+	RoutePlanner* pRoutes;
+	Object* pRouteObj;
+	bool bRoutesStale; //The graph changed since the hierarchy was built
+	ClusterTree* pClusters;
+	bool bEdgeLOD; //Draw the clustered cut instead of every edge
+	bool bClustersStale;
+	vmath::vec3 lodeye; //Eye the current cut was made for
+	bool bClusterColours; //Stars coloured by DBSCAN cluster
+	float dbscaneps;
+	std::vector<vmath::Tvec4<unsigned char>> starcolours; //Saved while recoloured
+	PointBVH* pStarPicker;
+	PointBVH* pPlanetoidPicker; //Refit every frame as the planetoids move
+	Object* pPlanetoidObj;
+	Object* pOrbitsObj;
+	bool bStarPickerStale;
+	SimThread* pSimThread; //Owns the planetoid clock
+	bool bGPUOrbits; //Planetoid positions evaluated in the vertex shader
+	PlanetoidStore* pPlanetoids;
+	NBody* pNBody;
+	bool bNBody; //Stars and planetoids move under their mutual gravity
+	std::vector<vmath::vec3> nbodystars; //Star positions saved while they move
 };
 
+//Clusters subtending less than this many radians draw as one star
+#define EDGE_LOD_DETAIL 0.05f
+//Neighbours within eps, the star itself included, that make a core star
+#define DBSCAN_MINPTS 3
+//How far from the cursor, in pixels, a click still picks a point
+#define PICK_PIXELS 4.f
+//Planetoids nearer each other than this count as a close approach
+#define CLOSE_APPROACH 0.02f
+//Orbital seconds the arrow keys jump back or forward
+#define SCRUB_SECONDS 10.0
+//Wall seconds per simulation step
+#define SIM_STEP (1.0 / 120.0)
+//Orbital seconds the shader may run from its epoch before the phases are
+//re-uploaded, keeping its float time precise
+#define GPU_EPOCH_SPAN 64.0
+//Masses in N-body mode; a planetoid barely pulls on anything
+#define STAR_MASS 0.01f
+#define PLANETOID_MASS 1e-7f
+//Bytes of vertices the streamed star field may keep loaded
+#define SECTOR_BUDGET (1 << 20)
+//Where K saves the scene
+#define SNAPSHOT_PATH "gltest.snap"
+
+void UploadDirtyEdges(struct Simulation* pSim)
+{
+	//Edge slot i is the index pair (2 * i, 2 * i + 1) of the element buffer
+	Graph* pGraph = pSim->pGraph;
+	if(pSim->bEdgeLOD)
+	{
+		pGraph->ClearDirtyEdges();
+		pSim->bClustersStale = true;
+		return;
+	}
+	size_t count = pGraph->GetEdges().size();
+	size_t lo = count, hi = 0;
+	for(unsigned int slot : pGraph->GetDirtyEdges())
+	{
+		if(slot < count)
+		{
+			lo = std::min(lo, (size_t) slot);
+			hi = std::max(hi, (size_t) slot + 1);
+		}
+	}
+	pGraph->ClearDirtyEdges();
+	pSim->pEdgesObj->UpdateIndexRange(pGraph->GetEdgeIndices(), count * 2,
+					  lo * 2, lo < hi ? (hi - lo) * 2 : 0);
+}
+
+void ShowRandomRoute(struct Simulation* pSim)
+{
+	Graph* pGraph = pSim->pGraph;
+	size_t count = pGraph->GetNodeCount();
+	if(!count)
+	{
+		return;
+	}
+	if(!pSim->pRoutes->IsBuilt() || pSim->bRoutesStale)
+	{
+		pSim->pRoutes->Build(*pGraph);
+		pSim->bRoutesStale = false;
+	}
+
+	uint32_t a = g_randgen.PRNG64() % count, b = g_randgen.PRNG64() % count;
+	if(pGraph->IsRemoved(a) || pGraph->IsRemoved(b))
+	{
+		return;
+	}
+
+	struct timespec t_a, t_b;
+	std::vector<uint32_t> path;
+	clock_gettime(CLOCK_MONOTONIC, &t_a);
+	float dist = pSim->pRoutes->Query(a, b, &path);
+	clock_gettime(CLOCK_MONOTONIC, &t_b);
+	printf("Route %u -> %u: length %f over %zu stars in %.1f us\n", a, b, dist,
+	       path.size(), TimeDiffSecs(&t_b, &t_a) * 1000000.f);
+
+	//Consecutive path nodes become line segments over the star vertices
+	std::vector<uint32_t> indices;
+	for(size_t i = 1; i < path.size(); ++i)
+	{
+		indices.push_back(path[i - 1]);
+		indices.push_back(path[i]);
+	}
+	pSim->pRouteObj->SetIndices(indices.empty() ? 0 : &indices[0], indices.size());
+}
+
+void CycleTopology(struct Simulation* pSim)
+{
+	//MST -> k-NN -> Gabriel -> RNG -> MST
+	Graph* pGraph = pSim->pGraph;
+	struct timespec t_a, t_b;
+	const char* name = "";
+	clock_gettime(CLOCK_MONOTONIC, &t_a);
+	switch(pGraph->GetTopology())
+	{
+	case GRAPH_MST:
+		pGraph->ConnectKNN(6, pSim->pPool);
+		name = "6-NN";
+		break;
+	case GRAPH_KNN:
+		pGraph->ConnectGabriel(pSim->pPool);
+		name = "Gabriel";
+		break;
+	case GRAPH_GABRIEL:
+		pGraph->ConnectRNG(pSim->pPool);
+		name = "RNG";
+		break;
+	default:
+		pGraph->ConnectMST(pSim->pPool);
+		name = "MST";
+		break;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t_b);
+	printf("%s: %zu edges in %f s\n", name, pGraph->GetEdges().size(),
+	       TimeDiffSecs(&t_b, &t_a));
+
+	if(pSim->bEdgeLOD)
+	{
+		pSim->bClustersStale = true;
+	}
+	else
+	{
+		pSim->pEdgesObj->SetIndices(pGraph->GetEdgeIndices(), pGraph->GetEdges().size() * 2);
+	}
+	pSim->bRoutesStale = true;
+	pSim->pRouteObj->SetIndices(0, 0);
+}
+
+void UpdateEdgeLOD(struct Simulation* pSim)
+{
+	//Only recut when the eye moved or the graph changed
+	const vmath::vec3& eye = pSim->pCamera->GetPosition();
+	if(!pSim->bClustersStale && eye[0] == pSim->lodeye[0] &&
+	   eye[1] == pSim->lodeye[1] && eye[2] == pSim->lodeye[2])
+	{
+		return;
+	}
+	if(pSim->bClustersStale)
+	{
+		pSim->pClusters->Build(*pSim->pGraph);
+		pSim->bClustersStale = false;
+	}
+	pSim->lodeye = eye;
+
+	std::vector<uint32_t> indices;
+	pSim->pClusters->Cut(eye, EDGE_LOD_DETAIL, indices);
+	pSim->pEdgesObj->SetIndices(indices.empty() ? 0 : &indices[0], indices.size());
+}
+
+void ToggleEdgeLOD(struct Simulation* pSim)
+{
+	pSim->bEdgeLOD = !pSim->bEdgeLOD;
+	if(pSim->bEdgeLOD)
+	{
+		UpdateEdgeLOD(pSim);
+		return;
+	}
+	Graph* pGraph = pSim->pGraph;
+	pGraph->ClearDirtyEdges();
+	pSim->pEdgesObj->SetIndices(pGraph->GetEdgeIndices(), pGraph->GetEdges().size() * 2);
+}
+
+void ColourClusters(struct Simulation* pSim)
+{
+	struct timespec t_a, t_b;
+	std::vector<uint32_t> labels;
+	clock_gettime(CLOCK_MONOTONIC, &t_a);
+	size_t count = pSim->pGraph->ClusterDBSCAN(pSim->dbscaneps, DBSCAN_MINPTS, labels,
+						   pSim->pPool);
+	clock_gettime(CLOCK_MONOTONIC, &t_b);
+	printf("DBSCAN eps %f: %zu clusters in %f s\n", pSim->dbscaneps, count,
+	       TimeDiffSecs(&t_b, &t_a));
+
+	//Cluster colours come from a hash of the label; noise is dimmed grey.
+	//Alpha is left alone as it hides removed stars.
+	std::vector<Vertex>& verts = pSim->pStarsObj->GetVerts();
+	for(size_t i = 0; i < labels.size(); ++i)
+	{
+		vmath::Tvec4<unsigned char>& colour = verts[i].color;
+		if(labels[i] == GRAPH_NOISE)
+		{
+			colour[0] = colour[1] = colour[2] = 64;
+			continue;
+		}
+		uint32_t h = labels[i] * 2654435761u;
+		colour[0] = 64 + (h >> 24) % 192;
+		colour[1] = 64 + (h >> 16) % 192;
+		colour[2] = 64 + (h >> 8) % 192;
+	}
+	pSim->pStarsObj->UpdateBufferRange(0, labels.size());
+}
+
+void ToggleClusterColours(struct Simulation* pSim)
+{
+	std::vector<Vertex>& verts = pSim->pStarsObj->GetVerts();
+	pSim->bClusterColours = !pSim->bClusterColours;
+	if(pSim->bClusterColours)
+	{
+		pSim->starcolours.resize(verts.size());
+		for(size_t i = 0; i < verts.size(); ++i)
+		{
+			pSim->starcolours[i] = verts[i].color;
+		}
+		ColourClusters(pSim);
+		return;
+	}
+
+	//Stars spawned meanwhile keep their colour
+	size_t count = std::min(pSim->starcolours.size(), verts.size());
+	for(size_t i = 0; i < count; ++i)
+	{
+		for(int c = 0; c < 3; ++c)
+		{
+			verts[i].color[c] = pSim->starcolours[i][c];
+		}
+	}
+	pSim->starcolours.clear();
+	pSim->pStarsObj->UpdateBufferRange(0, count);
+}
+
+void ScaleClusterRadius(struct Simulation* pSim, float factor)
+{
+	pSim->dbscaneps *= factor;
+	if(pSim->bClusterColours)
+	{
+		ColourClusters(pSim);
+	}
+}
+
+void ReorderStars(struct Simulation* pSim)
+{
+	if(pSim->bNBody)
+	{
+		printf("Turn N-body gravity off before reordering stars\n");
+		return;
+	}
+	//Spawned stars are appended at the end; sort everything back into
+	//Z-order and renumber whatever refers to a star
+	Graph* pGraph = pSim->pGraph;
+	size_t count = pGraph->GetNodeCount();
+	std::vector<vmath::vec3> positions(count);
+	for(size_t i = 0; i < count; ++i)
+	{
+		positions[i] = pGraph->GetPosition(i);
+	}
+	std::vector<uint32_t> order, newindex(count);
+	MortonOrder(count ? &positions[0] : 0, count, order, pSim->pPool);
+	for(size_t i = 0; i < count; ++i)
+	{
+		newindex[order[i]] = i;
+	}
+
+	pGraph->Permute(order, pSim->pPool);
+	pGraph->ClearDirtyEdges();
+
+	std::vector<Vertex>& verts = pSim->pStarsObj->GetVerts();
+	std::vector<Vertex> sorted;
+	sorted.reserve(count);
+	for(size_t i = 0; i < count; ++i)
+	{
+		sorted.push_back(verts[order[i]]);
+	}
+	std::copy(sorted.begin(), sorted.end(), verts.begin());
+	pSim->pStarsObj->UpdateBufferRange(0, count);
+
+	for(unsigned int& idx : pSim->spawned)
+	{
+		idx = newindex[idx];
+	}
+	if(pSim->starcolours.size() == count)
+	{
+		std::vector<vmath::Tvec4<unsigned char>> colours(count);
+		for(size_t i = 0; i < count; ++i)
+		{
+			colours[i] = pSim->starcolours[order[i]];
+		}
+		pSim->starcolours.swap(colours);
+	}
+
+	pSim->bRoutesStale = true;
+	pSim->bStarPickerStale = true;
+	pSim->pRouteObj->SetIndices(0, 0);
+	if(pSim->bEdgeLOD)
+	{
+		pSim->bClustersStale = true;
+	}
+	else
+	{
+		pSim->pEdgesObj->SetIndices(pGraph->GetEdgeIndices(), pGraph->GetEdges().size() * 2);
+	}
+}
+
+void PickUnderCursor(struct Simulation* pSim, GLFWwindow* window)
+{
+	double cx, cy;
+	int width, height;
+	glfwGetCursorPos(window, &cx, &cy);
+	glfwGetWindowSize(window, &width, &height);
+	if(width <= 0 || height <= 0)
+	{
+		return;
+	}
+
+	if(pSim->bStarPickerStale)
+	{
+		//Despawned stars keep their hidden vertices but cannot be picked
+		std::vector<Vertex>& verts = pSim->pStarsObj->GetVerts();
+		const std::vector<char>& removed = pSim->pGraph->GetRemoved();
+		pSim->pStarPicker->Build(verts.empty() ? 0 : &verts[0], verts.size(), pSim->pPool,
+					 removed.size() == verts.size() ? &removed[0] : 0);
+		pSim->bStarPickerStale = false;
+	}
+
+	struct timespec t_a, t_b;
+	clock_gettime(CLOCK_MONOTONIC, &t_a);
+	vmath::vec3 origin, dir;
+	Camera* pCam = pSim->pCamera;
+	pCam->GetPickRay(2.f * cx / width - 1.f, 1.f - 2.f * cy / height, &origin, &dir);
+	float spread = PICK_PIXELS * pCam->GetPixelSpread(height);
+	float tstar = INFINITY, tplanet = INFINITY;
+	uint32_t star = pSim->pStarPicker->Pick(origin, dir, spread, &tstar);
+	uint32_t planet = pSim->pPlanetoidPicker->Pick(origin, dir, spread, &tplanet);
+	clock_gettime(CLOCK_MONOTONIC, &t_b);
+
+	float us = TimeDiffSecs(&t_b, &t_a) * 1000000.f;
+	if(star != BVH_NO_HIT && tstar <= tplanet)
+	{
+		//The vertex, not the graph, has where N-body gravity moved it
+		const vmath::vec4& pos = pSim->pStarsObj->GetVerts()[star].vertex;
+		printf("Picked star %u at (%f, %f, %f) in %.1f us\n", star, pos[0], pos[1], pos[2], us);
+	}
+	else if(planet != BVH_NO_HIT)
+	{
+		const vmath::vec4& pos = pSim->pPlanetoidObj->GetVerts()[planet].vertex;
+		printf("Picked planetoid %u at (%f, %f, %f) in %.1f us\n", planet, pos[0], pos[1], pos[2], us);
+	}
+	else
+	{
+		printf("Nothing picked in %.1f us\n", us);
+	}
+}
+
+void SpawnStar(struct Simulation* pSim, const vmath::vec3& pos)
+{
+	if(pSim->bNBody)
+	{
+		printf("Turn N-body gravity off before spawning stars\n");
+		return;
+	}
+	pSim->pStarsObj->AddVertex(vmath::vec4(pos[0], pos[1], pos[2], 1.f),
+				   vmath::Tvec4<unsigned char>(255, 255, 0, 255));
+	pSim->pStarsObj->UpdateBufferRange(pSim->pStarsObj->GetVerts().size() - 1, 1);
+	pSim->spawned.push_back(pSim->pGraph->InsertNode(pos));
+	pSim->bRoutesStale = true;
+	pSim->bStarPickerStale = true;
+	UploadDirtyEdges(pSim);
+}
+
+void DespawnStar(struct Simulation* pSim)
+{
+	if(pSim->bNBody)
+	{
+		printf("Turn N-body gravity off before despawning stars\n");
+		return;
+	}
+	if(pSim->spawned.empty())
+	{
+		return;
+	}
+	unsigned int idx = pSim->spawned.back();
+	pSim->spawned.pop_back();
+	pSim->pGraph->RemoveNode(idx);
+	pSim->bRoutesStale = true;
+	pSim->bStarPickerStale = true;
+	pSim->pRouteObj->SetIndices(0, 0);
+
+	//Node indices are stable, so the star's vertex stays and is hidden
+	pSim->pStarsObj->GetVerts()[idx].color[3] = 0;
+	pSim->pStarsObj->UpdateBufferRange(idx, 1);
+	UploadDirtyEdges(pSim);
+}
+
+void ScaleTimeWarp(struct Simulation* pSim, double factor)
+{
+	SimThread* pThread = pSim->pSimThread;
+	pThread->SetTimeWarp(pThread->GetTimeWarp() * factor);
+	printf("Time warp %gx at t = %.1f s\n", pThread->GetTimeWarp(), pThread->GetTime());
+}
+
+void ToggleGPUOrbits(struct Simulation* pSim)
+{
+	pSim->bGPUOrbits = !pSim->bGPUOrbits;
+	//N-body positions always come from the CPU; the choice applies after
+	if(!pSim->bNBody)
+	{
+		pSim->pPlanetoidObj->SetUniform("gpuOrbits", pSim->bGPUOrbits ? 1.f : 0.f);
+	}
+	printf("Planetoid orbits evaluated on the %s\n", pSim->bGPUOrbits ? "GPU" : "CPU");
+}
+
+void ToggleNBody(struct Simulation* pSim)
+{
+	pSim->bNBody = !pSim->bNBody;
+	std::vector<Vertex>& stars = pSim->pStarsObj->GetVerts();
+	std::vector<Vertex>& planetoids = pSim->pPlanetoidObj->GetVerts();
+	pSim->bStarPickerStale = true;
+	if(!pSim->bNBody)
+	{
+		//Stars go back to where the graph has them; planetoids pick up
+		//their orbits again on the next frame
+		for(size_t i = 0; i < pSim->nbodystars.size(); ++i)
+		{
+			for(int d = 0; d < 3; ++d)
+			{
+				stars[i].vertex[d] = pSim->nbodystars[i][d];
+			}
+		}
+		pSim->pStarsObj->UpdateBufferRange(0, pSim->nbodystars.size());
+		pSim->pPlanetoidObj->SetUniform("gpuOrbits", pSim->bGPUOrbits ? 1.f : 0.f);
+		printf("N-body gravity off\n");
+		return;
+	}
+
+	size_t nstars = stars.size(), count = nstars + planetoids.size();
+	std::vector<vmath::vec3> positions(count), velocities(count, vmath::vec3(0.f, 0.f, 0.f));
+	std::vector<float> masses(count);
+	pSim->nbodystars.resize(nstars);
+	for(size_t i = 0; i < nstars; ++i)
+	{
+		pSim->nbodystars[i] = vmath::vec3(stars[i].vertex[0], stars[i].vertex[1], stars[i].vertex[2]);
+		positions[i] = pSim->nbodystars[i];
+		//Despawned stars stay as hidden vertices, so they weigh nothing
+		masses[i] = stars[i].color[3] ? STAR_MASS : 0.f;
+	}
+
+	//Planetoids start from the newest step on circular orbits of their
+	//star, going round the way their ellipse did
+	std::vector<Vertex> now(planetoids), ahead(planetoids);
+	double time = pSim->pSimThread->GetTime();
+	pSim->pPlanetoids->Evaluate(time, now.data(), pSim->pPool);
+	pSim->pPlanetoids->Evaluate(time + 1e-3, ahead.data(), pSim->pPool);
+	for(size_t i = 0; i < planetoids.size(); ++i)
+	{
+		vmath::vec3 pos(now[i].vertex[0], now[i].vertex[1], now[i].vertex[2]);
+		vmath::vec3 dir(ahead[i].vertex[0] - pos[0], ahead[i].vertex[1] - pos[1],
+				ahead[i].vertex[2] - pos[2]);
+		vmath::vec3 r = pos - pSim->pPlanetoids->GetFocus(i);
+		float r2 = vmath::dot(r, r);
+		dir = vmath::normalize(dir - r * (vmath::dot(dir, r) / r2));
+		positions[nstars + i] = pos;
+		velocities[nstars + i] = dir * sqrtf(STAR_MASS / sqrtf(r2));
+		masses[nstars + i] = PLANETOID_MASS;
+	}
+	pSim->pNBody->Init(&positions[0], &velocities[0], &masses[0], count, pSim->pPool);
+	pSim->pPlanetoidObj->SetUniform("gpuOrbits", 0.f);
+	printf("N-body gravity on for %zu bodies, opening angle %g\n", count,
+	       pSim->pNBody->GetOpeningAngle());
+}
+
+void SaveSnapshot(struct Simulation* pSim)
+{
+	if(pSim->bNBody)
+	{
+		printf("Turn N-body gravity off before saving\n");
+		return;
+	}
+	struct timespec t_a, t_b;
+	clock_gettime(CLOCK_MONOTONIC, &t_a);
+
+	//Planetoids are saved exactly at the time recorded, not where the
+	//renderer has blended them to
+	double time = pSim->pSimThread->GetTime();
+	std::vector<Vertex> planetoids(pSim->pPlanetoidObj->GetVerts());
+	pSim->pPlanetoids->Evaluate(time, planetoids.data(), pSim->pPool);
+
+	//Stars are saved in their own colours, not the cluster ones
+	const std::vector<Vertex>& stars = pSim->pStarsObj->GetVerts();
+	std::vector<Vertex> recoloured;
+	const Vertex* pStars = stars.data();
+	if(pSim->bClusterColours)
+	{
+		recoloured = stars;
+		size_t count = std::min(pSim->starcolours.size(), recoloured.size());
+		for(size_t i = 0; i < count; ++i)
+		{
+			for(int c = 0; c < 3; ++c)
+			{
+				recoloured[i].color[c] = pSim->starcolours[i][c];
+			}
+		}
+		pStars = recoloured.data();
+	}
+	const std::vector<Vertex>& orbits = pSim->pOrbitsObj->GetVerts();
+	const Graph* pGraph = pSim->pGraph;
+	uint32_t topology[2] = {(uint32_t) pGraph->GetTopology(), pGraph->GetKNN()};
+	SnapshotWriter writer;
+	writer.AddColumn(SNAPSHOT_STARS, pStars, sizeof(Vertex), stars.size());
+	writer.AddColumn(SNAPSHOT_PLANETOIDS, planetoids.data(), sizeof(Vertex), planetoids.size());
+	writer.AddColumn(SNAPSHOT_ORBITS, orbits.data(), sizeof(Vertex), orbits.size());
+	writer.AddColumn(SNAPSHOT_EDGES, pGraph->GetEdges().data(), sizeof(Edge), pGraph->GetEdges().size());
+	writer.AddColumn(SNAPSHOT_REMOVED, pGraph->GetRemoved().data(), sizeof(char), pGraph->GetRemoved().size());
+	writer.AddColumn(SNAPSHOT_TOPOLOGY, topology, sizeof(uint32_t), 2);
+	writer.AddColumn(SNAPSHOT_SPAWNED, pSim->spawned.data(), sizeof(unsigned int), pSim->spawned.size());
+	pSim->pPlanetoids->AddColumns(writer);
+	if(writer.Write(SNAPSHOT_PATH, time, g_randgen.GetSeed()))
+	{
+		clock_gettime(CLOCK_MONOTONIC, &t_b);
+		printf("Saved %s at t = %.1f s in %.1f ms\n", SNAPSHOT_PATH, time,
+		       TimeDiffSecs(&t_b, &t_a) * 1000.f);
+	}
+}
+
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
 	struct Simulation* pSim =
 		reinterpret_cast<struct Simulation*>(glfwGetWindowUserPointer(window));
 	Camera* pCam = pSim->pCamera;
-	Object* pStars = pSim->pStarsObj;
 
 	vmath::vec3& cam_velocity = pCam->GetVelocity();
 	float speed = 1.0f, rspeed = 45.f;
@@ -106,50 +667,90 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 		*(pCam->GetPitchSpeed()) = bPress ? rspeed : 0.f;
 		break;
 	case GLFW_KEY_F:
-		pStars->AddVertex(vmath::vec4(0.f, 0.f, 0.f, 1.f),
-				  vmath::Tvec4<unsigned char>(255, 255, 0, 255));
+		if(bPress)
+			SpawnStar(pSim, vmath::vec3(0.f, 0.f, 0.f));
+		break;
+	case GLFW_KEY_X:
+		if(action == GLFW_PRESS)
+			DespawnStar(pSim);
+		break;
+	case GLFW_KEY_R:
+		if(action == GLFW_PRESS)
+			ShowRandomRoute(pSim);
+		break;
+	case GLFW_KEY_T:
+		if(action == GLFW_PRESS)
+			CycleTopology(pSim);
+		break;
+	case GLFW_KEY_L:
+		if(action == GLFW_PRESS)
+			ToggleEdgeLOD(pSim);
+		break;
+	case GLFW_KEY_C:
+		if(action == GLFW_PRESS)
+			ToggleClusterColours(pSim);
+		break;
+	case GLFW_KEY_LEFT_BRACKET:
+		if(bPress)
+			ScaleClusterRadius(pSim, 1.f / 1.25f);
+		break;
+	case GLFW_KEY_RIGHT_BRACKET:
+		if(bPress)
+			ScaleClusterRadius(pSim, 1.25f);
+		break;
+	case GLFW_KEY_O:
+		if(action == GLFW_PRESS)
+			ReorderStars(pSim);
+		break;
+	case GLFW_KEY_M:
+		if(action == GLFW_PRESS)
+			MemReport();
+		break;
+	case GLFW_KEY_COMMA:
+		if(bPress)
+			ScaleTimeWarp(pSim, 0.5);
+		break;
+	case GLFW_KEY_PERIOD:
+		if(bPress)
+			ScaleTimeWarp(pSim, 2.0);
+		break;
+	case GLFW_KEY_G:
+		if(action == GLFW_PRESS)
+			ToggleGPUOrbits(pSim);
+		break;
+	case GLFW_KEY_N:
+		if(action == GLFW_PRESS)
+			ToggleNBody(pSim);
+		break;
+	case GLFW_KEY_K:
+		if(action == GLFW_PRESS)
+			SaveSnapshot(pSim);
+		break;
+	case GLFW_KEY_MINUS:
+		if(action == GLFW_PRESS)
+			ScaleTimeWarp(pSim, -1.0);
+		break;
+	case GLFW_KEY_LEFT:
+		if(bPress)
+			pSim->pSimThread->Scrub(-SCRUB_SECONDS);
+		break;
+	case GLFW_KEY_RIGHT:
+		if(bPress)
+			pSim->pSimThread->Scrub(SCRUB_SECONDS);
 		break;
 	default: [[likely]]
 		break;
 	}
 }
 
-class RandGen
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 {
-public:
-	RandGen()
-	{
-		struct timespec ts;
-		clock_gettime(CLOCK_REALTIME, &ts);
-		m_seed = ts.tv_sec << 32 | ts.tv_nsec;
-		srandom(ts.tv_sec | ts.tv_nsec);
-		m_wyhash64 = 0xFeedFaceDeadBeef; //This is the seed
-	}
-
-	u_int64_t PRNG64()
-	{
-		//PRNG algo by Vladimir Makarov
-		m_wyhash64 += 0x60bee2bee120fc15;
-		__uint128_t tmp;
-		tmp = (__uint128_t) m_wyhash64 * 0xa3b195354a39b70d;
-		u_int64_t m1 = (tmp >> 64) ^ tmp;
-		tmp = (__uint128_t)m1 * 0x1b03738712fad5c9;
-		u_int64_t m2 = (tmp >> 64) ^ tmp;
-		return m2;
-	}
-
-	double RandDouble(u_int64_t max)
+	struct Simulation* pSim =
+		reinterpret_cast<struct Simulation*>(glfwGetWindowUserPointer(window));
+	if(button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
 	{
-		return fmod(((double) PRNG64()), ((double) max));
+		PickUnderCursor(pSim, window);
 	}
-
-private:
-	unsigned long long m_seed, m_wyhash64;
-};
-
-float TimeDiffSecs(struct timespec *b, struct timespec *a)
-{
-	return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1000000000.0;
 }
 
 void GenerateGrid(Object& obj, int density = 5);
@@ -203,8 +804,6 @@ void ReleaseGL(GLFWwindow* pWindow)
 	glfwTerminate();
 }
 
-RandGen g_randgen;
-
 void Ellipse(float* x, float* y, float* z, float t,
 	     float a, float b, float cx, float cy, float cz,
 	     const vmath::Tquaternion<float>& rot
@@ -225,18 +824,17 @@ void Ellipse(float* x, float* y, float* z, float t,
 	*z = coord[2] + cz;
 }
 
+//Uniforms each planetoid is generated from
+#define PLANETOID_RANDOMS 9
+
 struct Planetoid
 {
 	Planetoid(float x, float y, float z,
 		  unsigned char cr, unsigned char cg, unsigned char cb,
-		  float lasta)
-	{
-		float theta = ((g_randgen.RandDouble(20) - 10.f) * PI)/180.f;
-		vmath::vec3 randuv(
-			g_randgen.RandDouble(50),
-			g_randgen.RandDouble(50),
-			g_randgen.RandDouble(50)
-			);
+		  float lasta, const float* rand)
+	{
+		float theta = ((rand[0] * 20.f - 10.f) * PI)/180.f;
+		vmath::vec3 randuv(rand[1], rand[2], rand[3]);
 		randuv = vmath::normalize(randuv);
 
 		float stf = sin(theta/2.f);
@@ -247,24 +845,23 @@ struct Planetoid
 			1.f * cos(theta/2.f));
 		invrot = rot.inverse();
 
-		bool bNeg = (g_randgen.PRNG64() & 255) > 128;
 		//anglerate = (PI/180.f) * (g_randgen.RandDouble(30) + 5.f) * (bNeg ? -1.f : 1.f);
 
 
-		float first = g_randgen.RandDouble(5)/100.f + 0.02f + lasta;
-		float second = first + g_randgen.RandDouble(3)/100.f;
+		float first = rand[4] * 0.05f + 0.02f + lasta;
+		float second = first + rand[5] * 0.03f;
 		float avgr = (first + second) / 2.f;
 		//anglerate = (1.f / (avgr * sqrt(avgr))) * (bNeg ? -1.f : 1.f);
 		anglerate = 1/sqrt(avgr); // by Kepler's 2nd law of motion; orbital speed decreases with distance from star
-		bool bFlip = (g_randgen.PRNG64() & 255) > 128;
+		bool bFlip = rand[6] >= 0.5f;
 		a = bFlip ? first : second;
 		b = bFlip ? second : first;
 
-		c = g_randgen.RandDouble(10)/100.f + 0.05f + lasta;
+		c = rand[7] * 0.1f + 0.05f + lasta;
 
 		//phi = g_randgen.RandDouble(30) * (PI/180.f);
 
-		t = (float) g_randgen.RandDouble(157)/100.f;
+		t = rand[8] * 1.57f;
 		Ellipse(&sx, &sy, &sz, t, a, b, x, y, z, rot);
 
 		red = cr;
@@ -279,22 +876,6 @@ struct Planetoid
 			t, a, b, sx, sy, sz, rot);
 
 	}
-	void CalculateOffset(float t_del, vmath::vec3& offset)
-	{
-		float dtheta = t_del * anglerate;
-		//Use derivative of ellipse equation
-		vmath::Tquaternion<float> off(
-			a * -sin(t) * dtheta,
-			0.f * dtheta,
-			b * cos(t) * dtheta,
-			1.f);
-
-		vmath::vec4 result = rot * off * invrot;
-		offset[0] = result[0];
-		offset[1] = result[1];
-		offset[2] = result[2];
-		t += dtheta;
-	}
 
 	float sx, sy, sz; //Center
 	float a, b, c, phi, t, anglerate;
@@ -302,7 +883,7 @@ struct Planetoid
 	vmath::Tquaternion<float> rot, invrot;
 };
 
-void CreateEllipse(Object& obj, float ox, float oy, float oz,
+void CreateEllipse(std::vector<Vertex>& verts, float ox, float oy, float oz,
 		   float a, float b, float c,
 		   float phi, vmath::Tquaternion<float>& rot)
 {
@@ -314,21 +895,145 @@ void CreateEllipse(Object& obj, float ox, float oy, float oz,
 		float t = (TWOPI/segments) * idx;
 		float x = 0.f, y = 0.f, z = 0.f;
 		Ellipse(&x, &y, &z, t, a, b, ox, oy, oz, rot);
-		obj.AddVertex(vmath::vec4(x, y, z, 1.f),
-			      vmath::Tvec4<unsigned char>(cval, cval, cval, 255)
-			);
+		verts.emplace_back(vmath::Tvec4<unsigned char>(cval, cval, cval, 255),
+				   vmath::vec4(x, y, z, 1.f));
 
 		t = (TWOPI/segments) * (idx - 1);
 		Ellipse(&x, &y, &z, t, a, b, ox, oy, oz, rot);
 
-		obj.AddVertex(vmath::vec4(x, y, z, 1.f),
-			      vmath::Tvec4<unsigned char>(cval, cval, cval, 255)
-			);
+		verts.emplace_back(vmath::Tvec4<unsigned char>(cval, cval, cval, 255),
+				   vmath::vec4(x, y, z, 1.f));
 	}
 }
 
-int main()
+//A star and everything generated with it
+struct StarSystem
 {
+	StarSystem() :
+		colour(0, 0, 0, 255)
+	{
+	}
+
+	vmath::Tvec4<unsigned char> colour;
+	PlanetoidStore planetoids;
+	std::vector<Vertex> planetoidverts, orbitverts;
+};
+
+//Star number star draws from stream (star, 0) and its planet i from
+//(star, i + 1), so a system depends only on the seed and its number
+void GenerateStarSystem(StarSystem& sys, const vmath::vec3& pos, unsigned long long seed, uint32_t star)
+{
+	float srand[4];
+	RandStream(seed, star, 0).FillFloats(srand, 4);
+	unsigned char red = srand[0] * 256.f;
+	unsigned char green = srand[1] * 256.f;
+	unsigned char blue = srand[2] * 256.f;
+	sys.colour = vmath::Tvec4<unsigned char>(red, green, blue, 255);
+
+	int numplanets = (int) (srand[3] * 7.f) + 1;
+	float lasta = 0.05f;
+	for(int i = 0; i < numplanets; ++i)
+	{
+		float prand[PLANETOID_RANDOMS];
+		RandStream(seed, star, i + 1).FillFloats(prand, PLANETOID_RANDOMS);
+		Planetoid planet(pos[0], pos[1], pos[2], red, green, blue, lasta, prand);
+		sys.planetoids.Add(pos, planet.a, planet.b, planet.t, planet.anglerate, planet.rot);
+		vmath::vec3 orbit = sys.planetoids.GetOrbitCentre(i);
+		sys.planetoidverts.emplace_back(vmath::Tvec4<unsigned char>(planet.red, planet.green,
+									    planet.blue, planet.alpha),
+						vmath::vec4(planet.sx, planet.sy, planet.sz, 1.f));
+		CreateEllipse(sys.orbitverts, orbit[0], orbit[1], orbit[2],
+			      planet.a, planet.b, planet.c,
+			      planet.phi, planet.rot);
+		lasta = planet.a;
+	}
+}
+
+//Takes the scene from a snapshot, uploading the vertices straight from
+//its mapping; the objects and the planetoid store still copy what they
+//own. Nothing is touched unless every column is there.
+bool LoadScene(const SnapshotReader& snapshot, Object& stars, Object& planetoidobj,
+	       Object& orbits, PlanetoidStore& planetoids)
+{
+	size_t nstars = 0, nplanetoids = 0, norbits = 0;
+	const Vertex* pStars = snapshot.GetColumn<Vertex>(SNAPSHOT_STARS, &nstars);
+	const Vertex* pPlanetoids = snapshot.GetColumn<Vertex>(SNAPSHOT_PLANETOIDS, &nplanetoids);
+	const Vertex* pOrbits = snapshot.GetColumn<Vertex>(SNAPSHOT_ORBITS, &norbits);
+	PlanetoidStore store;
+	if(!pStars || !pPlanetoids || !pOrbits || !store.ReadColumns(snapshot) ||
+	   store.Size() != nplanetoids)
+	{
+		return false;
+	}
+	planetoids.Append(store);
+	stars.InitBuffer(pStars, nstars);
+	planetoidobj.InitBuffer(pPlanetoids, nplanetoids);
+	orbits.InitBuffer(pOrbits, norbits);
+	return true;
+}
+
+//Stars spawned before the save, so they can still be despawned; a column
+//that does not fit the stars is dropped
+void RestoreSpawned(const SnapshotReader& snapshot, size_t nstars, std::vector<unsigned int>& spawned)
+{
+	size_t count = 0;
+	const uint32_t* pSpawned = snapshot.GetColumn<uint32_t>(SNAPSHOT_SPAWNED, &count);
+	for(size_t i = 0; i < count; ++i)
+	{
+		if(pSpawned[i] >= nstars)
+		{
+			return;
+		}
+	}
+	spawned.assign(pSpawned, pSpawned + count);
+}
+
+//Saved edges, or false to have them rebuilt
+bool RestoreGraph(const SnapshotReader& snapshot, Graph& graph, ThreadPool* pPool)
+{
+	size_t nedges = 0, nremoved = 0, ntopology = 0;
+	const Edge* pEdges = snapshot.GetColumn<Edge>(SNAPSHOT_EDGES, &nedges);
+	const char* pRemoved = snapshot.GetColumn<char>(SNAPSHOT_REMOVED, &nremoved);
+	const uint32_t* pTopology = snapshot.GetColumn<uint32_t>(SNAPSHOT_TOPOLOGY, &ntopology);
+	if(!pEdges || !pRemoved || nremoved != graph.GetNodeCount() || ntopology != 2 ||
+	   pTopology[0] > GRAPH_RNG)
+	{
+		return false;
+	}
+	for(size_t i = 0; i < nedges; ++i)
+	{
+		if(pEdges[i].i0 >= nremoved || pEdges[i].i1 >= nremoved)
+		{
+			return false;
+		}
+	}
+	graph.RestoreEdges(pEdges, nedges, pRemoved, (GraphTopology) pTopology[0], pTopology[1], pPool);
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	//The whole scene follows from the seed; pass one to repeat a run, or a
+	//snapshot to carry on from where it was saved
+	SnapshotReader snapshot;
+	bool bLoaded = false;
+	unsigned long long seed = GLTEST_SEED;
+	if(argc > 1)
+	{
+		char* end = 0;
+		seed = strtoull(argv[1], &end, 0);
+		if(*end)
+		{
+			if(!snapshot.Open(argv[1]))
+			{
+				return 0;
+			}
+			bLoaded = true;
+			seed = snapshot.GetSeed();
+		}
+	}
+	g_randgen = RandGen(seed);
+	printf("Seed %llu\n", g_randgen.GetSeed());
 
 	GLFWwindow* window = 0;
 	if(InitGL(&window) < 0)
@@ -352,14 +1057,18 @@ int main()
 	camera.SetPosition(vmath::vec3(0.f, 1.f, -2.f));
 	camera.LookAt(vmath::vec3(0.f, 0.f, 0.f));
 
-	Object axesobj(GL_LINES), stars_obj(GL_POINTS), edges_obj(GL_LINES);
-	Object planetoidobj(GL_POINTS);
-	Object orbitsobj(GL_LINES);
+	Object axesobj(GL_LINES, "Axes"), stars_obj(GL_POINTS, "Stars"), edges_obj(GL_LINES, "Edges");
+	Object route_obj(GL_LINES, "Route");
+	Object planetoidobj(GL_POINTS, "Planetoids");
+	Object orbitsobj(GL_LINES, "Orbit lines");
+	Object fieldobj(GL_POINTS, "Star field");
 
 
 	struct Simulation sim;
 	sim.pCamera = &camera;
 	sim.pStarsObj = &stars_obj;
+	sim.pEdgesObj = &edges_obj;
+	sim.pRouteObj = &route_obj;
 	glfwSetWindowUserPointer(window, &sim);
 
 	vmath::mat4 scale = vmath::scale(1.f, 1.f, 1.f);
@@ -368,6 +1077,7 @@ int main()
 	axesobj.SetObjectTransform(scale);
 	planetoidobj.SetObjectTransform(scale);
 	orbitsobj.SetObjectTransform(scale);
+	fieldobj.SetObjectTransform(scale);
 
 	GenerateGrid(axesobj);
 
@@ -391,85 +1101,168 @@ int main()
 
 	printf("%f %f %f %f\n", rotation[0], rotation[1], rotation[2], rotation[3]);
 	printf("%f %f %f %f\n", inverse[0], inverse[1], inverse[2], inverse[3]);
-	std::vector<Planetoid> planetoids;
+	PlanetoidStore planetoids;
+
 
+	ThreadPool pool;
 
-	std::vector<vmath::vec3> others;
 	float mindist = 0.6f; //minimum distance between stars
-	for(int idx = 0; idx < 12; ++idx)
-	{
-		float x = g_randgen.RandDouble(200)/100.f - 1.f;
-		float y = g_randgen.RandDouble(200)/100.f - 1.f;
-		float z = g_randgen.RandDouble(200)/100.f - 1.f;
-		vmath::vec3 testpoint(x, y, z);
-		float closest = -1.f;
-		for(int i = 0; i < others.size(); ++i)
+	if(bLoaded)
+	{
+		struct timespec t_a, t_b;
+		clock_gettime(CLOCK_MONOTONIC, &t_a);
+		if(!LoadScene(snapshot, stars_obj, planetoidobj, orbitsobj, planetoids))
 		{
-			float dist = vmath::distance(others[i], testpoint);
-			if(closest < 0.f || dist < closest)
-			{
-				closest = dist;
-			}
+			fprintf(stderr, "Snapshot %s is missing part of the scene.\n", argv[1]);
+			return 0;
 		}
-		if(closest >= 0.f && closest <= mindist)
+		RestoreSpawned(snapshot, stars_obj.GetVerts().size(), sim.spawned);
+		clock_gettime(CLOCK_MONOTONIC, &t_b);
+		printf("Loaded %s: %zu stars, %zu planetoids at t = %.1f s in %.1f ms\n", argv[1],
+		       stars_obj.GetVerts().size(), planetoids.Size(), snapshot.GetTime(),
+		       TimeDiffSecs(&t_b, &t_a) * 1000.f);
+	}
+	else
+	{
+		std::vector<vmath::vec3> starpositions;
+		size_t starcount = 12;
+		PoissonDiskSample(starpositions, starcount, mindist,
+				  vmath::vec3(-1.f, -1.f, -1.f), vmath::vec3(1.f, 1.f, 1.f),
+				  g_randgen.PRNG64(), &pool);
+
+		//Stars, and with them their planetoids and orbits, are generated in
+		//Z-order so that neighbours in space are neighbours in memory
+		std::vector<uint32_t> zorder;
+		MortonOrder(starpositions.empty() ? 0 : &starpositions[0], starpositions.size(),
+			    zorder, &pool);
+		std::vector<vmath::vec3> zsorted(starpositions.size());
+		for(size_t idx = 0; idx < zorder.size(); ++idx)
 		{
-			printf("%f < %f\n", closest, mindist);
-			continue;
+			zsorted[idx] = starpositions[zorder[idx]];
 		}
+		starpositions.swap(zsorted);
 
-		unsigned char red = (g_randgen.PRNG64() + 128) & 255;
-		unsigned char green = (g_randgen.PRNG64() + 128) & 255;
-		unsigned char blue = (g_randgen.PRNG64() + 128) & 255;
-
-		others.emplace_back(vmath::vec3(x, y, z));
-		stars_obj.AddVertex(vmath::vec4(x, y, z, 1.f),
-				    vmath::Tvec4<unsigned char>(red, green, blue, 255));
-		int numplanets = (int) g_randgen.RandDouble(7) + 1;
-		float lasta = 0.05f;
-		for(int i = 0; i < numplanets; ++i)
+		//Systems are generated in parallel and then appended in star order,
+		//so the scene is the same for any number of threads
+		std::vector<StarSystem> systems(starpositions.size());
+		unsigned long long sceneseed = g_randgen.GetSeed();
+		pool.ParallelFor(0, systems.size(), 1, [&](size_t first, size_t last)
 		{
-			Planetoid planet(x, y, z, red, green, blue, lasta);
-			planetoids.emplace_back(planet);
-			planetoidobj.AddVertex(vmath::vec4(planet.sx, planet.sy, planet.sz, 1.f),
-					       vmath::Tvec4<unsigned char>(planet.red,
-									   planet.green,
-									   planet.blue,
-									   planet.alpha)
-				);
-			CreateEllipse(orbitsobj, x, y, z,
-				      planet.a, planet.b, planet.c,
-				      planet.phi, planet.rot);
-			lasta = planet.a;
+			for(size_t idx = first; idx < last; ++idx)
+			{
+				GenerateStarSystem(systems[idx], starpositions[idx], sceneseed, idx);
+			}
+		});
+		for(size_t idx = 0; idx < systems.size(); ++idx)
+		{
+			const StarSystem& sys = systems[idx];
+			stars_obj.AddVertex(vmath::vec4(starpositions[idx][0], starpositions[idx][1],
+							starpositions[idx][2], 1.f), sys.colour);
+			planetoids.Append(sys.planetoids);
+			for(const Vertex& v : sys.planetoidverts)
+			{
+				planetoidobj.AddVertex(v.vertex, v.color);
+			}
+			for(const Vertex& v : sys.orbitverts)
+			{
+				orbitsobj.AddVertex(v.vertex, v.color);
+			}
 		}
-	}
+		systems.clear();
+
+		planetoids.Evaluate(0.0, planetoidobj.GetVerts().data(), &pool);
 
 		orbitsobj.InitBuffer();
+		planetoidobj.InitBuffer();
+		stars_obj.InitBuffer();
+	}
+
 	orbitsobj.LoadShaders("orbit.vert", "axes.frag");
-	planetoidobj.InitBuffer();
 	planetoidobj.LoadShaders("planetoid.vert", "stars.frag");
 
+	//Orbits for the shader are uploaded once; only the time changes
+	std::vector<float> orbitfocus, orbitmajor, orbitminor;
+	double orbitepoch = 0.0;
+	planetoids.GetOrbitAttributes(orbitepoch, orbitfocus, orbitmajor, orbitminor);
+	planetoidobj.AddAttribute(2, 4, orbitfocus.data(), planetoids.Size());
+	planetoidobj.AddAttribute(3, 4, orbitmajor.data(), planetoids.Size());
+	planetoidobj.AddAttribute(4, 4, orbitminor.data(), planetoids.Size());
+	planetoidobj.SetUniform("gpuOrbits", 0.f);
+	planetoidobj.SetUniform("orbitTime", 0.f);
+
+	//The graph builds on the pool while this thread sets up the GL side
 	Graph star_graph(stars_obj.GetVerts());
-	star_graph.ConnectMST();
+	ThreadPool::TaskHandle starindex = pool.Submit([&star_graph, &pool]
+						       {
+							       star_graph.BuildIndex(&pool);
+						       });
+	ThreadPool::TaskHandle starmst = pool.Submit([&star_graph, &pool, &snapshot, bLoaded]
+						     {
+							     if(!bLoaded || !RestoreGraph(snapshot, star_graph, &pool))
+							     {
+								     star_graph.ConnectMST(&pool);
+							     }
+						     }, {starindex});
+	sim.pGraph = &star_graph;
+	sim.pPool = &pool;
 
-	std::vector<Edge>& edges = star_graph.GetEdges();
-	for(int i = 0, z = edges.size(); i < z; ++i)
-	{
-		Edge& edge = edges[i];
-		vmath::vec3& a = edge.v0;
-		vmath::vec3& b = edge.v1;
-		edges_obj.AddVertex(vmath::vec4(a[0], a[1], a[2], 1.f),
-				    vmath::Tvec4<unsigned char>(128, 128, 128, 128));
-		edges_obj.AddVertex(vmath::vec4(b[0], b[1], b[2], 1.f),
-				    vmath::Tvec4<unsigned char>(128, 128, 128, 128));
-	}
+	stars_obj.LoadShaders("stars.vert", "stars.frag");
 
+	edges_obj.ShareVertices(stars_obj);
 	edges_obj.InitBuffer();
-	edges_obj.LoadShaders("stars.vert", "stars.frag");
-
-	stars_obj.InitBuffer();
-	stars_obj.LoadShaders("stars.vert", "stars.frag");
+	pool.Wait(starmst);
+	edges_obj.SetIndices(star_graph.GetEdgeIndices(), star_graph.GetEdges().size() * 2);
+	edges_obj.LoadShaders("edges.vert", "stars.frag");
+
+	RoutePlanner routes;
+	sim.pRoutes = &routes;
+	sim.bRoutesStale = true;
+	route_obj.SetObjectTransform(scale);
+	route_obj.ShareVertices(stars_obj);
+	route_obj.InitBuffer();
+	route_obj.SetIndices(0, 0);
+	route_obj.LoadShaders("route.vert", "stars.frag");
+
+	ClusterTree clusters;
+	sim.pClusters = &clusters;
+	sim.bEdgeLOD = false;
+	sim.bClustersStale = true;
+	sim.bClusterColours = false;
+
+	PointBVH starpicker("Star picking"), planetoidpicker("Planetoid picking");
+	sim.pStarPicker = &starpicker;
+	sim.pPlanetoidPicker = &planetoidpicker;
+	sim.pPlanetoidObj = &planetoidobj;
+	sim.pOrbitsObj = &orbitsobj;
+	sim.bGPUOrbits = false;
+	sim.bStarPickerStale = true;
+	planetoidpicker.Build(planetoidobj.GetVerts().data(), planetoidobj.GetVerts().size(), &pool);
+	SweepAndPrune approaches;
+	SimThread simthread(&planetoids, planetoidobj.GetVerts(), SIM_STEP, &pool);
+	sim.pSimThread = &simthread;
+	if(bLoaded)
+	{
+		simthread.Scrub(snapshot.GetTime());
+	}
+	NBody nbody;
+	sim.pPlanetoids = &planetoids;
+	sim.pNBody = &nbody;
+	sim.bNBody = false;
+	sim.dbscaneps = 1.5f * mindist;
+
+	//Beyond the scene, stars stream in by sector as the camera moves; the
+	//slots start hidden and nothing is generated until the first frame
+	SectorStreamer sectors(g_randgen.GetSeed(), SECTOR_BUDGET, &pool);
+	std::vector<uint32_t> sectorslots;
+	for(size_t idx = 0; idx < sectors.GetVertexCount(); ++idx)
+	{
+		fieldobj.AddVertex(vmath::vec4(0.f, 0.f, 0.f, 1.f), vmath::Tvec4<unsigned char>(0, 0, 0, 0));
+	}
+	fieldobj.InitBuffer();
+	fieldobj.LoadShaders("stars.vert", "stars.frag");
 
 	glfwSetKeyCallback(window, key_callback);
+	glfwSetMouseButtonCallback(window, mouse_button_callback);
 
 	struct timespec t_a, t_b;
 	memset(&t_a, 0, sizeof(struct timespec));
@@ -481,9 +1274,11 @@ int main()
 
 	std::vector<Object*> scene_objs;
 	scene_objs.push_back(&axesobj);
+	scene_objs.push_back(&fieldobj);
 	scene_objs.push_back(&stars_obj);
 	scene_objs.push_back(&orbitsobj);
 	scene_objs.push_back(&edges_obj);
+	scene_objs.push_back(&route_obj);
 
 
 	std::vector<Vertex>& verts = planetoidobj.GetVerts();
@@ -499,12 +1294,16 @@ int main()
 		{
 			pObj->Draw(&camera);
 			//pObj->Rotate(rotation, inverse);
-			pObj->UpdateBuffer();
 		}
 
 		planetoidobj.Draw(&camera);
 		//planetoidobj.Rotate(rotation, inverse);
 
+		if(sim.bEdgeLOD)
+		{
+			UpdateEdgeLOD(&sim);
+		}
+
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 		//glfwWaitEvents();
@@ -513,15 +1312,43 @@ int main()
 
 
 		std::vector<Vertex>& planetverts = planetoidobj.GetVerts();
-		vmath::vec3 offset;
-		for(int i = 0; i < planetoids.size(); ++i)
+		if(sim.bNBody)
+		{
+			//One fixed step per frame keeps the leapfrog symplectic
+			size_t nstars = sim.nbodystars.size();
+			nbody.Step(SIM_STEP, &pool);
+			nbody.GetPositions(0, nstars, stars_obj.GetVerts().data());
+			nbody.GetPositions(nstars, planetverts.size(), planetverts.data());
+			stars_obj.UpdateBufferRange(0, nstars);
+			planetoidobj.UpdateBuffer();
+			sim.bStarPickerStale = true;
+		}
+		else if(sim.bGPUOrbits)
 		{
-			planetoids[i].CalculateOffset(t_del, offset);
-			planetverts[i].vertex[0] += offset[0];
-			planetverts[i].vertex[1] += offset[1];
-			planetverts[i].vertex[2] += offset[2];
+			//Picking and close approaches still use the CPU positions
+			double orbittime = simthread.Interpolate(planetverts.data());
+			if(fabs(orbittime - orbitepoch) > GPU_EPOCH_SPAN)
+			{
+				orbitepoch = orbittime;
+				planetoids.GetOrbitAttributes(orbitepoch, orbitfocus, orbitmajor, orbitminor);
+				planetoidobj.UpdateAttribute(4, orbitminor.data());
+			}
+			planetoidobj.SetUniform("orbitTime", orbittime - orbitepoch);
+		}
+		else
+		{
+			simthread.Interpolate(planetverts.data());
+			planetoidobj.UpdateBuffer();
+		}
+		planetoidpicker.Refit(planetverts.data(), &pool);
+		approaches.Update(planetverts.data(), planetverts.size(), CLOSE_APPROACH, &pool);
+		if(!approaches.GetBegun().empty() || !approaches.GetEnded().empty())
+		{
+			snprintf(titlebuf, sizeof(titlebuf), "Projection Test - %zu close approaches (%zu begun, %zu ended)",
+				 approaches.GetPairs().size(), approaches.GetBegun().size(),
+				 approaches.GetEnded().size());
+			glfwSetWindowTitle(window, titlebuf);
 		}
-		planetoidobj.UpdateBuffer();
 
 
 		//HACK: Don't compare a float for equality
@@ -559,8 +1386,16 @@ int main()
 		}
 		camera.Move(camera.GetVelocity() * t_del);
 		camera.LookAtTarget();
+
+		sectorslots.clear();
+		sectors.Update(camera.GetPosition(), fieldobj.GetVerts().data(), sectorslots);
+		for(uint32_t slot : sectorslots)
+		{
+			fieldobj.UpdateBufferRange(slot * SECTOR_STARS, SECTOR_STARS);
+		}
 	}
 
+	MemReport();
 	printf("Terminating!\n");
 
 	return 0;
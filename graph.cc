@@ -1,54 +1,986 @@
 #include "graph.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include "threadpool.h"
+#include "ssemath.h"
 
-Graph::Graph(const std::vector<Vertex>& verts)
+#define GRAPH_INSERT_CANDIDATES 16
+
+Graph::Graph(const std::vector<Vertex>& verts) :
+	m_livecount(verts.size()),
+	m_topology(GRAPH_MST),
+	m_knn(0),
+	m_pendingfirst(verts.size()),
+	m_stampgen(0),
+	m_nodemem("Graph nodes"),
+	m_edgemem("Graph edges")
 {
-	m_nodes.reserve(verts.size());
+	m_x.resize(verts.size());
+	m_y.resize(verts.size());
+	m_z.resize(verts.size());
 	for(int i = 0, z = verts.size(); i < z; ++i)
 	{
 		const vmath::vec4& vec = verts[i].vertex;
-		m_nodes.emplace_back(
-			Node(vmath::vec3(vec[0], vec[1], vec[2]))
-			);
+		m_x[i] = vec[0];
+		m_y[i] = vec[1];
+		m_z[i] = vec[2];
 	}
+	m_removed.assign(verts.size(), 0);
+	UpdateMemory();
 }
 
-void Graph::ConnectMST()
+void Graph::UpdateMemory()
 {
-	//FIXME: A nasty Log(O^2) brute force algorithm
-	std::vector<Node*> graph;
-	std::vector<Node*> nodes;
-	nodes.reserve(m_nodes.size());
-	graph.reserve(m_nodes.size());
+	//Adjacency lists are counted by their entries rather than walked
+	size_t adjbytes = m_adj.capacity() * sizeof(m_adj[0]);
+	if(!m_adj.empty())
+	{
+		adjbytes += 2 * m_edges.size() * sizeof(unsigned int);
+	}
+	m_nodemem.SetCPU((m_x.capacity() + m_y.capacity() + m_z.capacity()) * sizeof(float) +
+			 m_removed.capacity() +
+			 (m_stamp.capacity() + m_from.capacity()) * sizeof(unsigned int));
+	m_edgemem.SetCPU(m_edges.capacity() * sizeof(Edge) + adjbytes +
+			 m_forest.GetMemoryUsage() +
+			 (m_nodelc.capacity() + m_edgelc.capacity()) * sizeof(uint32_t) +
+			 m_scratch.capacity() * sizeof(float) +
+			 m_dirty.capacity() * sizeof(unsigned int));
+}
 
-	for(int i = 0, z = m_nodes.size(); i < z; ++i)
+void Graph::BuildIndex(ThreadPool* pPool)
+{
+	std::vector<vmath::vec3> points;
+	std::vector<uint32_t> ids;
+	points.reserve(m_livecount);
+	ids.reserve(m_livecount);
+	for(size_t i = 0, z = m_x.size(); i < z; ++i)
 	{
-		nodes.push_back(&m_nodes[i]);
+		if(!m_removed[i])
+		{
+			points.push_back(GetPosition(i));
+			ids.push_back(i);
+		}
 	}
+	m_tree.Build(points.empty() ? 0 : &points[0], points.size(), pPool,
+		     ids.empty() ? 0 : &ids[0]);
+	m_pendingfirst = m_x.size();
+}
 
-	graph.emplace_back(&m_nodes[0]);
+//Lock-free union-find over tree positions. Roots are only ever linked
+//beneath smaller roots, so a component's root is its smallest position
+//whatever order the unions run in.
+static uint32_t FindRoot(std::atomic<uint32_t>* parent, uint32_t x)
+{
+	uint32_t p = parent[x].load(std::memory_order_relaxed);
+	while(p != x)
+	{
+		//Path halving; a stale grandparent is still an ancestor
+		uint32_t gp = parent[p].load(std::memory_order_relaxed);
+		parent[x].compare_exchange_weak(p, gp, std::memory_order_relaxed);
+		x = gp;
+		p = parent[x].load(std::memory_order_relaxed);
+	}
+	return x;
+}
 
-	Node* pThis = graph[0];
+static void Unite(std::atomic<uint32_t>* parent, uint32_t a, uint32_t b)
+{
+	for(;;)
+	{
+		a = FindRoot(parent, a);
+		b = FindRoot(parent, b);
+		if(a == b)
+		{
+			return;
+		}
+		if(a > b)
+		{
+			std::swap(a, b);
+		}
+		uint32_t expected = b;
+		if(parent[b].compare_exchange_strong(expected, a, std::memory_order_acq_rel))
+		{
+			return;
+		}
+	}
+}
 
-	while(nodes.size())
+static void ForRange(ThreadPool* pPool, size_t count, size_t grain,
+		     const std::function<void(size_t, size_t)>& fn)
+{
+	if(pPool)
 	{
-		auto it = nodes.begin();
-		std::vector<Node*>::iterator pMin = nodes.end();
-		float mindist = 0.f;
+		pPool->ParallelFor(0, count, grain, fn);
+	}
+	else if(count)
+	{
+		fn(0, count);
+	}
+}
+
+void Graph::RefreshIndex(ThreadPool* pPool)
+{
+	if(m_tree.Size() != m_livecount || m_pendingfirst != m_x.size())
+	{
+		BuildIndex(pPool);
+	}
+}
+
+void Graph::ResetEdges(ThreadPool* pPool)
+{
+	m_edges.clear();
+	m_adj.clear();
+	m_forest.Clear();
+	m_dirty.clear();
+	RefreshIndex(pPool);
+}
 
-		for(auto z = nodes.end(); it != z; ++it)
+void Graph::RestoreEdges(const Edge* edges, size_t count, const char* removed,
+			 GraphTopology topology, unsigned int k, ThreadPool* pPool)
+{
+	m_removed.assign(removed, removed + m_x.size());
+	m_livecount = std::count(m_removed.begin(), m_removed.end(), 0);
+	ResetEdges(pPool);
+	m_topology = topology;
+	m_knn = k;
+	m_edges.assign(edges, edges + count);
+	UpdateMemory();
+}
+
+void Graph::ConnectMST(ThreadPool* pPool)
+{
+	ResetEdges(pPool);
+	m_topology = GRAPH_MST;
+	const KDTree& tree = m_tree;
+	size_t n = tree.Size();
+	if(n < 2)
+	{
+		UpdateMemory();
+		return;
+	}
+	const size_t grain = 4096;
+
+	//Edges are ordered by (length, lower index, higher index) so that
+	//equal lengths can never close a cycle and the tree is unique.
+	//A point's nearest neighbour outside its component stays nearest for as
+	//long as it remains outside, since merging only removes candidates. For
+	//the same reason the last distance found is a lower bound for later rounds.
+	std::unique_ptr<std::atomic<uint32_t>[]> parent(new std::atomic<uint32_t>[n]);
+	std::unique_ptr<std::atomic<uint32_t>[]> best(new std::atomic<uint32_t>[n]);
+	std::unique_ptr<std::atomic<uint32_t>[]> bound(new std::atomic<uint32_t>[n]);
+	std::vector<uint32_t> labels(n), nodelabels, nearest(n, KD_NO_INDEX);
+	std::vector<float> nearestd2(n, 0.f);
+	for(size_t i = 0; i < n; ++i)
+	{
+		parent[i].store(i, std::memory_order_relaxed);
+	}
+
+	auto floatbits = [](float f)
+	{
+		uint32_t bits;
+		memcpy(&bits, &f, sizeof(bits));
+		return bits;
+	};
+	auto bitsfloat = [](uint32_t bits)
+	{
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+		return f;
+	};
+
+	//True when the candidate edge of position a beats that of position b
+	auto better = [&tree, &nearest, &nearestd2](uint32_t a, uint32_t b)
+	{
+		if(b == KD_NO_INDEX)
+		{
+			return true;
+		}
+		if(nearestd2[a] != nearestd2[b])
+		{
+			return nearestd2[a] < nearestd2[b];
+		}
+		uint32_t a0 = tree.GetIndex(a), a1 = tree.GetIndex(nearest[a]);
+		uint32_t b0 = tree.GetIndex(b), b1 = tree.GetIndex(nearest[b]);
+		uint32_t alo = std::min(a0, a1), blo = std::min(b0, b1);
+		if(alo != blo)
 		{
-			Node* pNode = *it;
-			float dist = pThis->DistanceTo(*pNode);
-			if(pMin == nodes.end() || dist < mindist)
+			return alo < blo;
+		}
+		return std::max(a0, a1) < std::max(b0, b1);
+	};
+
+	m_edges.reserve(n - 1);
+	std::vector<uint32_t> roots, chosen;
+	size_t components = n;
+	while(components > 1)
+	{
+		ForRange(pPool, n, grain, [&](size_t first, size_t last)
+			 {
+				 for(size_t pos = first; pos < last; ++pos)
+				 {
+					 labels[pos] = FindRoot(parent.get(), pos);
+					 best[pos].store(KD_NO_INDEX, std::memory_order_relaxed);
+					 bound[pos].store(floatbits(INFINITY), std::memory_order_relaxed);
+				 }
+			 });
+		tree.LabelNodes(&labels[0], nodelabels);
+
+		//Every point refreshes its nearest outside neighbour. The shared
+		//per-component bound only prunes; it never changes the result.
+		ForRange(pPool, n, grain / 16, [&](size_t first, size_t last)
+			 {
+				 for(size_t pos = first; pos < last; ++pos)
+				 {
+					 uint32_t label = labels[pos];
+					 uint32_t q = nearest[pos];
+					 if(q != KD_NO_INDEX && labels[q] != label)
+					 {
+						 continue;
+					 }
+
+					 float compbound = bitsfloat(bound[label].load(std::memory_order_relaxed));
+					 if(nearestd2[pos] > compbound)
+					 {
+						 nearest[pos] = KD_NO_INDEX;
+						 continue;
+					 }
+
+					 float d2 = compbound;
+					 long found = tree.NearestOtherLabel(pos, &labels[0], &nodelabels[0], &d2);
+					 if(found < 0)
+					 {
+						 //Nothing within the bound, which is therefore
+						 //a lower bound for this point
+						 nearest[pos] = KD_NO_INDEX;
+						 nearestd2[pos] = compbound;
+						 continue;
+					 }
+					 nearest[pos] = found;
+					 nearestd2[pos] = d2;
+
+					 uint32_t bits = floatbits(d2);
+					 uint32_t cur = bound[label].load(std::memory_order_relaxed);
+					 while(bits < cur &&
+					       !bound[label].compare_exchange_weak(cur, bits, std::memory_order_relaxed))
+					 {
+					 }
+				 }
+			 });
+
+		//Reduce to each component's best candidate
+		ForRange(pPool, n, grain, [&](size_t first, size_t last)
+			 {
+				 for(size_t pos = first; pos < last; ++pos)
+				 {
+					 uint32_t q = nearest[pos];
+					 if(q == KD_NO_INDEX || labels[q] == labels[pos])
+					 {
+						 continue;
+					 }
+					 std::atomic<uint32_t>& slot = best[labels[pos]];
+					 uint32_t cur = slot.load(std::memory_order_relaxed);
+					 while(better(pos, cur) &&
+					       !slot.compare_exchange_weak(cur, pos, std::memory_order_relaxed))
+					 {
+					 }
+				 }
+			 });
+
+		//Two components that picked the same edge keep it once, under the
+		//lower label. The chosen edges form a forest, so nothing else repeats.
+		chosen.clear();
+		for(size_t pos = 0; pos < n; ++pos)
+		{
+			if(labels[pos] != pos)
+			{
+				continue;
+			}
+			uint32_t p = best[pos].load(std::memory_order_relaxed);
+			uint32_t other = labels[nearest[p]];
+			uint32_t otherbest = best[other].load(std::memory_order_relaxed);
+			bool bSame = otherbest != KD_NO_INDEX &&
+				labels[nearest[otherbest]] == pos &&
+				std::min(p, nearest[p]) == std::min(otherbest, nearest[otherbest]) &&
+				std::max(p, nearest[p]) == std::max(otherbest, nearest[otherbest]);
+			if(bSame && other < pos)
 			{
-				mindist = dist;
-				pMin = it;
+				continue;
 			}
+			chosen.push_back(p);
 		}
-		graph.push_back(*pMin);
-		m_edges.emplace_back(Edge(pThis->GetVert(), (*pMin)->GetVert()));
-		pThis = *pMin;
-		nodes.erase(pMin);
+
+		ForRange(pPool, chosen.size(), 256, [&](size_t first, size_t last)
+			 {
+				 for(size_t i = first; i < last; ++i)
+				 {
+					 Unite(parent.get(), chosen[i], nearest[chosen[i]]);
+				 }
+			 });
+
+		for(uint32_t p : chosen)
+		{
+			uint32_t a = tree.GetIndex(p), b = tree.GetIndex(nearest[p]);
+			if(a > b)
+			{
+				std::swap(a, b);
+			}
+			m_edges.emplace_back(Edge(a, b));
+		}
+		components -= chosen.size();
+	}
+	UpdateMemory();
+}
+
+void Graph::ConnectKNN(unsigned int k, ThreadPool* pPool)
+{
+	ResetEdges(pPool);
+	m_topology = GRAPH_KNN;
+	m_knn = k;
+	size_t n = m_tree.Size();
+	if(n < 2 || !k)
+	{
+		UpdateMemory();
+		return;
+	}
+
+	//k + 1 as every point finds itself
+	std::vector<vmath::vec3> queries(n);
+	for(size_t pos = 0; pos < n; ++pos)
+	{
+		queries[pos] = m_tree.GetPoint(pos);
+	}
+	std::vector<KDNeighbour> result;
+	m_tree.KNearestBatch(&queries[0], n, k + 1, result, pPool);
+
+	//The union of everyone's lists: each pair once, lower index first
+	std::vector<uint64_t> pairs;
+	pairs.reserve(n * k);
+	for(size_t pos = 0; pos < n; ++pos)
+	{
+		uint32_t idx = m_tree.GetIndex(pos);
+		for(unsigned int j = 0; j <= k; ++j)
+		{
+			uint32_t other = result[pos * (k + 1) + j].index;
+			if(other != idx && other != KD_NO_INDEX)
+			{
+				pairs.push_back(((uint64_t) std::min(idx, other) << 32) | std::max(idx, other));
+			}
+		}
+	}
+	std::sort(pairs.begin(), pairs.end());
+	pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+	m_edges.reserve(pairs.size());
+	for(uint64_t pair : pairs)
+	{
+		m_edges.emplace_back(Edge(pair >> 32, pair & 0xFFFFFFFFu));
+	}
+	UpdateMemory();
+}
+
+void Graph::ConnectGabriel(ThreadPool* pPool)
+{
+	ConnectEmptyRegion(false, pPool);
+}
+
+void Graph::ConnectRNG(ThreadPool* pPool)
+{
+	ConnectEmptyRegion(true, pPool);
+}
+
+void Graph::ConnectEmptyRegion(bool bRelative, ThreadPool* pPool)
+{
+	ResetEdges(pPool);
+	m_topology = bRelative ? GRAPH_RNG : GRAPH_GABRIEL;
+	size_t n = m_tree.Size();
+
+	//Both relations are symmetric, so each side keeps the edges to higher
+	//indices. Chunks are joined in order, which keeps the output the same
+	//for any thread count.
+	const size_t grain = 1024;
+	std::vector<std::vector<Edge>> parts((n + grain - 1) / grain);
+	ForRange(pPool, n, grain,
+		 [this, bRelative, &parts](size_t first, size_t last)
+		 {
+			 std::vector<uint32_t> neighbours;
+			 std::vector<Edge>& part = parts[first / grain];
+			 for(size_t pos = first; pos < last; ++pos)
+			 {
+				 uint32_t idx = m_tree.GetIndex(pos);
+				 neighbours.clear();
+				 m_tree.EmptyRegionNeighbours(pos, bRelative, neighbours);
+				 for(uint32_t other : neighbours)
+				 {
+					 if(idx < other)
+					 {
+						 part.emplace_back(Edge(idx, other));
+					 }
+				 }
+			 }
+		 });
+
+	for(const std::vector<Edge>& part : parts)
+	{
+		m_edges.insert(m_edges.end(), part.begin(), part.end());
+	}
+	UpdateMemory();
+}
+
+size_t Graph::ClusterDBSCAN(float eps, unsigned int minpts, std::vector<uint32_t>& labels,
+			    ThreadPool* pPool)
+{
+	RefreshIndex(pPool);
+	const KDTree& tree = m_tree;
+	size_t n = tree.Size();
+	labels.assign(m_x.size(), GRAPH_NOISE);
+	const size_t grain = 1024;
+
+	//Core points have minpts nodes within eps, themselves included
+	std::vector<char> core(n);
+	std::unique_ptr<std::atomic<uint32_t>[]> parent(new std::atomic<uint32_t>[n]);
+	ForRange(pPool, n, grain, [&](size_t first, size_t last)
+		 {
+			 for(size_t pos = first; pos < last; ++pos)
+			 {
+				 core[pos] = tree.CountRadius(pos, eps, minpts) >= minpts;
+				 parent[pos].store(pos, std::memory_order_relaxed);
+			 }
+		 });
+
+	//Core points within eps of each other share a cluster. A border point
+	//joins the cluster of its nearest core point, ties going to the lower
+	//position, so the labels do not depend on the thread count.
+	std::vector<uint32_t> border(n, KD_NO_INDEX);
+	ForRange(pPool, n, grain, [&](size_t first, size_t last)
+		 {
+			 std::vector<uint32_t> neighbours;
+			 for(size_t pos = first; pos < last; ++pos)
+			 {
+				 neighbours.clear();
+				 tree.RadiusPositions(pos, eps, neighbours);
+				 if(core[pos])
+				 {
+					 for(uint32_t q : neighbours)
+					 {
+						 if(q < pos && core[q])
+						 {
+							 Unite(parent.get(), pos, q);
+						 }
+					 }
+					 continue;
+				 }
+				 vmath::vec3 p = tree.GetPoint(pos);
+				 float bestd2 = INFINITY;
+				 for(uint32_t q : neighbours)
+				 {
+					 if(!core[q])
+					 {
+						 continue;
+					 }
+					 vmath::vec3 d = tree.GetPoint(q) - p;
+					 float d2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+					 if(d2 < bestd2 || (d2 == bestd2 && q < border[pos]))
+					 {
+						 bestd2 = d2;
+						 border[pos] = q;
+					 }
+				 }
+			 }
+		 });
+
+	//Roots are the lowest position in each cluster, so numbering them in
+	//position order meets every root before the rest of its cluster
+	std::vector<uint32_t> cluster(n, GRAPH_NOISE);
+	size_t count = 0;
+	for(size_t pos = 0; pos < n; ++pos)
+	{
+		if(!core[pos])
+		{
+			continue;
+		}
+		uint32_t root = FindRoot(parent.get(), pos);
+		if(root == pos)
+		{
+			cluster[pos] = count++;
+		}
+		labels[tree.GetIndex(pos)] = cluster[root];
+	}
+	for(size_t pos = 0; pos < n; ++pos)
+	{
+		if(border[pos] != KD_NO_INDEX)
+		{
+			labels[tree.GetIndex(pos)] = cluster[FindRoot(parent.get(), border[pos])];
+		}
+	}
+	return count;
+}
+
+void Graph::Permute(const std::vector<uint32_t>& order, ThreadPool* pPool)
+{
+	size_t n = m_x.size();
+	std::vector<float> x(n), y(n), z(n);
+	std::vector<char> removed(n);
+	for(size_t i = 0; i < n; ++i)
+	{
+		uint32_t old = order[i];
+		x[i] = m_x[old];
+		y[i] = m_y[old];
+		z[i] = m_z[old];
+		removed[i] = m_removed[old];
 	}
+	m_x.swap(x);
+	m_y.swap(y);
+	m_z.swap(z);
+	m_removed.swap(removed);
+
+	//The incremental state is keyed and tie-broken by node index, so it
+	//is rebuilt rather than renumbered
+	BuildIndex(pPool);
+	Reconnect(pPool);
+}
 
+void Graph::Reconnect(ThreadPool* pPool)
+{
+	//Full rebuild for topologies without incremental maintenance; every
+	//slot that held an edge before or after is reported
+	size_t before = m_edges.size();
+	switch(m_topology)
+	{
+	case GRAPH_KNN:
+		ConnectKNN(m_knn, pPool);
+		break;
+	case GRAPH_GABRIEL:
+		ConnectGabriel(pPool);
+		break;
+	case GRAPH_RNG:
+		ConnectRNG(pPool);
+		break;
+	default:
+		ConnectMST(pPool);
+		break;
+	}
+	for(size_t i = 0, z = std::max(before, m_edges.size()); i < z; ++i)
+	{
+		m_dirty.push_back(i);
+	}
+}
+
+bool Graph::EdgeLess(unsigned int a0, unsigned int a1, unsigned int b0, unsigned int b1)
+{
+	//Same total order as ConnectMST: length, then lower and higher index
+	float da = EdgeLength2(a0, a1), db = EdgeLength2(b0, b1);
+	if(da != db)
+	{
+		return da < db;
+	}
+	if(std::min(a0, a1) != std::min(b0, b1))
+	{
+		return std::min(a0, a1) < std::min(b0, b1);
+	}
+	return std::max(a0, a1) < std::max(b0, b1);
+}
+
+void Graph::AddEdge(unsigned int a, unsigned int b)
+{
+	unsigned int slot = m_edges.size();
+	m_edges.emplace_back(Edge(a, b));
+	m_adj[a].push_back(slot);
+	m_adj[b].push_back(slot);
+	m_dirty.push_back(slot);
+
+	uint32_t lc = m_forest.AddNode(EdgeLength2(a, b), std::min(a, b), std::max(a, b));
+	m_forest.Link(m_nodelc[a], lc);
+	m_forest.Link(lc, m_nodelc[b]);
+	m_edgelc.push_back(lc);
+}
+
+void Graph::RemoveEdge(unsigned int slot)
+{
+	auto unlink = [this](unsigned int node, unsigned int from, unsigned int to)
+	{
+		std::vector<unsigned int>& list = m_adj[node];
+		for(size_t i = 0; i < list.size(); ++i)
+		{
+			if(list[i] == from)
+			{
+				if(to == (unsigned int) -1)
+				{
+					list[i] = list.back();
+					list.pop_back();
+				}
+				else
+				{
+					list[i] = to;
+				}
+				return;
+			}
+		}
+	};
+
+	Edge& edge = m_edges[slot];
+	unlink(edge.i0, slot, -1);
+	unlink(edge.i1, slot, -1);
+	m_forest.Cut(m_nodelc[edge.i0], m_edgelc[slot]);
+	m_forest.Cut(m_edgelc[slot], m_nodelc[edge.i1]);
+	m_forest.RemoveNode(m_edgelc[slot]);
+
+	unsigned int last = m_edges.size() - 1;
+	if(slot != last)
+	{
+		m_edges[slot] = m_edges[last];
+		m_edgelc[slot] = m_edgelc[last];
+		unlink(m_edges[slot].i0, last, slot);
+		unlink(m_edges[slot].i1, last, slot);
+	}
+	m_edges.pop_back();
+	m_edgelc.pop_back();
+	m_dirty.push_back(slot);
+}
+
+void Graph::BuildAdjacency()
+{
+	m_adj.assign(m_x.size(), std::vector<unsigned int>());
+	m_forest.Clear();
+	m_nodelc.resize(m_x.size());
+	for(size_t i = 0, z = m_x.size(); i < z; ++i)
+	{
+		m_nodelc[i] = m_forest.AddNode();
+	}
+	m_edgelc.resize(m_edges.size());
+	for(size_t i = 0, z = m_edges.size(); i < z; ++i)
+	{
+		const Edge& edge = m_edges[i];
+		m_adj[edge.i0].push_back(i);
+		m_adj[edge.i1].push_back(i);
+		m_edgelc[i] = m_forest.AddNode(EdgeLength2(edge.i0, edge.i1),
+					       std::min(edge.i0, edge.i1),
+					       std::max(edge.i0, edge.i1));
+		m_forest.Link(m_nodelc[edge.i0], m_edgelc[i]);
+		m_forest.Link(m_edgelc[i], m_nodelc[edge.i1]);
+	}
+	m_stamp.assign(m_x.size(), 0);
+	m_from.resize(m_x.size());
+}
+
+void Graph::NearestLive(const vmath::vec3& v, unsigned int k, std::vector<KDNeighbour>& out)
+{
+	//The k-d tree covers everything but the recently inserted nodes,
+	//which are few enough to scan
+	m_tree.KNearest(v, k, out, 0.f, &m_removed[0]);
+	ScanPending(v);
+	for(size_t i = 0, z = m_scratch.size(); i < z; ++i)
+	{
+		if(!m_removed[m_pendingfirst + i])
+		{
+			out.push_back(KDNeighbour{m_scratch[i], (uint32_t) (m_pendingfirst + i)});
+		}
+	}
+	std::sort(out.begin(), out.end());
+	if(out.size() > k)
+	{
+		out.resize(k);
+	}
+}
+
+void Graph::ScanPending(const vmath::vec3& v)
+{
+	size_t count = m_x.size() - m_pendingfirst;
+	m_scratch.resize(count);
+	if(count)
+	{
+		Distance2Batch(&m_x[m_pendingfirst], &m_y[m_pendingfirst], &m_z[m_pendingfirst],
+			       count, v[0], v[1], v[2], &m_scratch[0]);
+	}
+}
+
+long Graph::MaxEdgeOnPath(unsigned int from, unsigned int to)
+{
+	uint32_t worst = m_forest.PathMax(m_nodelc[from], m_nodelc[to]);
+	if(worst == LC_NONE)
+	{
+		return -1;
+	}
+	//The forest keys an edge by its endpoints; find its slot from either
+	uint32_t a, b;
+	m_forest.GetEndpoints(worst, &a, &b);
+	for(unsigned int slot : m_adj[a])
+	{
+		if(m_edges[slot].i0 == b || m_edges[slot].i1 == b)
+		{
+			return slot;
+		}
+	}
+	return -1;
+}
+
+unsigned int Graph::InsertNode(const vmath::vec3& v)
+{
+	if(m_topology != GRAPH_MST)
+	{
+		unsigned int idx = m_x.size();
+		m_x.push_back(v[0]);
+		m_y.push_back(v[1]);
+		m_z.push_back(v[2]);
+		m_removed.push_back(0);
+		++m_livecount;
+		Reconnect();
+		return idx;
+	}
+	if(m_adj.size() != m_x.size())
+	{
+		BuildAdjacency();
+	}
+
+	unsigned int idx = m_x.size();
+	std::vector<KDNeighbour> candidates;
+	if(m_livecount)
+	{
+		NearestLive(v, GRAPH_INSERT_CANDIDATES, candidates);
+	}
+
+	m_x.push_back(v[0]);
+	m_y.push_back(v[1]);
+	m_z.push_back(v[2]);
+	m_removed.push_back(0);
+	m_adj.emplace_back();
+	m_nodelc.push_back(m_forest.AddNode());
+	m_stamp.push_back(0);
+	m_from.push_back(0);
+	++m_livecount;
+
+	//Nearest first: the first link always joins the new node to the tree,
+	//later ones only replace a longer edge on the cycle they would close
+	for(size_t i = 0; i < candidates.size(); ++i)
+	{
+		unsigned int other = candidates[i].index;
+		if(i > 0)
+		{
+			long worst = MaxEdgeOnPath(idx, other);
+			if(worst < 0 ||
+			   !EdgeLess(idx, other, m_edges[worst].i0, m_edges[worst].i1))
+			{
+				continue;
+			}
+			RemoveEdge(worst);
+		}
+		AddEdge(idx, other);
+	}
+
+	//Fold the pending nodes into the k-d tree once scanning them costs
+	//more than an amortised rebuild
+	if(m_x.size() - m_pendingfirst > 256 + 2 * (size_t) sqrtf((float) m_livecount))
+	{
+		BuildIndex();
+	}
+	UpdateMemory();
+	return idx;
+}
+
+void Graph::RemoveNode(unsigned int idx)
+{
+	if(m_removed[idx])
+	{
+		return;
+	}
+	if(m_topology != GRAPH_MST)
+	{
+		m_removed[idx] = 1;
+		--m_livecount;
+		Reconnect();
+		return;
+	}
+	if(m_adj.size() != m_x.size())
+	{
+		BuildAdjacency();
+	}
+
+	m_removed[idx] = 1;
+	--m_livecount;
+
+	std::vector<unsigned int> roots;
+	while(!m_adj[idx].empty())
+	{
+		unsigned int slot = m_adj[idx].back();
+		const Edge& edge = m_edges[slot];
+		roots.push_back(edge.i0 == idx ? edge.i1 : edge.i0);
+		RemoveEdge(slot);
+	}
+	if(roots.size() < 2)
+	{
+		UpdateMemory();
+		return;
+	}
+
+	//Every remaining tree edge stays in the MST, so only the subtrees left
+	//hanging off idx need joining. They are explored in lockstep; once all
+	//but one are exhausted, the unexplored remainder is the last one and
+	//the exploration cost is bounded by the smaller subtrees.
+	if(++m_stampgen == 0)
+	{
+		std::fill(m_stamp.begin(), m_stamp.end(), 0);
+		m_stampgen = 1;
+	}
+	const unsigned int stamp = m_stampgen;
+	size_t pieces = roots.size();
+	std::vector<std::vector<unsigned int>> members(pieces);
+	std::vector<size_t> heads(pieces, 0);
+	for(size_t p = 0; p < pieces; ++p)
+	{
+		members[p].push_back(roots[p]);
+		m_stamp[roots[p]] = stamp;
+		m_from[roots[p]] = p;
+	}
+
+	size_t open = pieces;
+	long rest = -1;
+	while(open > 1)
+	{
+		open = 0;
+		for(size_t p = 0; p < pieces; ++p)
+		{
+			if(heads[p] >= members[p].size())
+			{
+				continue;
+			}
+			unsigned int node = members[p][heads[p]++];
+			for(unsigned int slot : m_adj[node])
+			{
+				const Edge& edge = m_edges[slot];
+				unsigned int next = edge.i0 == node ? edge.i1 : edge.i0;
+				if(m_stamp[next] != stamp)
+				{
+					m_stamp[next] = stamp;
+					m_from[next] = p;
+					members[p].push_back(next);
+				}
+			}
+			if(heads[p] < members[p].size())
+			{
+				++open;
+				rest = p;
+			}
+		}
+	}
+	if(open == 0)
+	{
+		rest = -1;
+	}
+
+	//Boruvka over the pieces. Each round every piece not yet joined to the
+	//unexplored remainder adds its shortest outgoing edge, which belongs to
+	//the MST by the cut property.
+	std::vector<unsigned int> piece(pieces);
+	for(size_t p = 0; p < pieces; ++p)
+	{
+		piece[p] = p;
+	}
+	auto findpiece = [&piece](unsigned int p)
+	{
+		while(piece[p] != p)
+		{
+			piece[p] = piece[piece[p]];
+			p = piece[p];
+		}
+		return p;
+	};
+	auto pieceof = [this, stamp, rest, &findpiece](unsigned int node) -> long
+	{
+		if(m_stamp[node] != stamp)
+		{
+			return rest >= 0 ? findpiece(rest) : -1;
+		}
+		return findpiece(m_from[node]);
+	};
+
+	size_t components = pieces;
+	std::vector<unsigned int> compmembers;
+	while(components > 1)
+	{
+		std::vector<long> besta(pieces, -1), bestb(pieces, -1);
+		std::vector<float> bestd2(pieces, INFINITY);
+		for(size_t c = 0; c < pieces; ++c)
+		{
+			if(findpiece(c) != c || (rest >= 0 && findpiece(rest) == c))
+			{
+				continue;
+			}
+
+			//Flagging the component as removed for the duration of its
+			//queries makes the nearest unflagged point the nearest outside
+			compmembers.clear();
+			for(size_t p = 0; p < pieces; ++p)
+			{
+				if(findpiece(p) == c)
+				{
+					compmembers.insert(compmembers.end(),
+							   members[p].begin(), members[p].end());
+				}
+			}
+			for(unsigned int node : compmembers)
+			{
+				m_removed[node] = 1;
+			}
+
+			for(unsigned int node : compmembers)
+			{
+				vmath::vec3 v = GetPosition(node);
+				float d2 = bestd2[c];
+				long hit = m_tree.NearestUnskipped(v, &m_removed[0], &d2);
+				if(hit >= 0 &&
+				   (besta[c] < 0 || EdgeLess(node, hit, besta[c], bestb[c])))
+				{
+					besta[c] = node;
+					bestb[c] = hit;
+					bestd2[c] = d2;
+				}
+				ScanPending(v);
+				for(size_t i = 0, z = m_scratch.size(); i < z; ++i)
+				{
+					unsigned int other = m_pendingfirst + i;
+					if(m_removed[other] || m_scratch[i] > bestd2[c])
+					{
+						continue;
+					}
+					if(besta[c] < 0 || EdgeLess(node, other, besta[c], bestb[c]))
+					{
+						besta[c] = node;
+						bestb[c] = other;
+						bestd2[c] = m_scratch[i];
+					}
+				}
+			}
+
+			for(unsigned int node : compmembers)
+			{
+				m_removed[node] = 0;
+			}
+		}
+
+		bool bMerged = false;
+		for(size_t c = 0; c < pieces; ++c)
+		{
+			if(besta[c] < 0)
+			{
+				continue;
+			}
+			long a = findpiece(c), b = pieceof(bestb[c]);
+			if(b < 0 || a == b)
+			{
+				continue;
+			}
+			piece[std::max(a, b)] = std::min(a, b);
+			AddEdge(besta[c], bestb[c]);
+			--components;
+			bMerged = true;
+		}
+		if(!bMerged)
+		{
+			break;
+		}
+	}
+	UpdateMemory();
 }
@@ -1,54 +1,201 @@
 #ifndef GRAPH_H_
 #define GRAPH_H_
 #include <vector>
+#include <cstdint>
 #include "vertex.h"
 #include "vmath.h"
+#include "memstats.h"
+#include "kdtree.h"
+#include "linkcut.h"
 
-class Node
-{
-public:
-	Node(const vmath::vec3& v)
-	{
-		vert = v;
-	}
+#define GRAPH_NOISE 0xFFFFFFFFu
 
-	float DistanceTo(const Node& other)
-	{
-		return vmath::distance(vert, other.vert);
-	}
+class ThreadPool;
 
-	vmath::vec3& GetVert()
-	{
-		return vert;
-	}
-private:
-	vmath::vec3 vert;
+enum GraphTopology
+{
+	GRAPH_MST,
+	GRAPH_KNN,
+	GRAPH_GABRIEL,
+	GRAPH_RNG
 };
 
+//An edge is just the node indices of its endpoints, which are also the
+//star vertex indices, so an array of edges is a GL_LINES element buffer
 struct Edge
 {
-	vmath::vec3 v0, v1;
-	Edge(const vmath::vec3& a, const vmath::vec3& b)
+	uint32_t i0, i1;
+	Edge(uint32_t ia, uint32_t ib)
 	{
-		v0 = a;
-		v1 = b;
+		i0 = ia;
+		i1 = ib;
 	}
 };
 
+static_assert(sizeof(Edge) == 2 * sizeof(uint32_t), "Edge must be an index pair");
+
 class Graph
 {
 public:
 	Graph(const std::vector<Vertex>& verts);
 
-	void ConnectMST();
+	//(Re)builds the k-d tree over the node positions
+	void BuildIndex(ThreadPool* pPool = 0);
+
+	const KDTree& GetSpatialIndex() const
+	{
+		return m_tree;
+	}
+
+	//Euclidean minimum spanning tree by Boruvka's algorithm over the k-d tree.
+	//With a pool each round's searches run on the workers; the tree is the
+	//same for any thread count.
+	void ConnectMST(ThreadPool* pPool = 0);
+
+	//Alternative topologies over the same index. Each replaces the edge
+	//list and is built in parallel on the pool with the same result for
+	//any thread count.
+	//Union of every node's k nearest neighbours
+	void ConnectKNN(unsigned int k, ThreadPool* pPool = 0);
+	//Pairs whose diametral ball holds no other node
+	void ConnectGabriel(ThreadPool* pPool = 0);
+	//Pairs with no node nearer to both than they are to each other; a
+	//subgraph of the Gabriel graph containing the MST
+	void ConnectRNG(ThreadPool* pPool = 0);
+
+	//DBSCAN over the node positions: nodes with at least minpts nodes
+	//within eps, themselves included, are core and chain into clusters,
+	//nodes within eps of a core node border its cluster and the rest are
+	//noise. labels receives a cluster number per node, GRAPH_NOISE for
+	//noise and removed nodes; returns the number of clusters. Neighbour
+	//queries go through the k-d tree and clusters are joined with a
+	//lock-free union-find on the pool, with the same result for any thread
+	//count.
+	size_t ClusterDBSCAN(float eps, unsigned int minpts, std::vector<uint32_t>& labels,
+			     ThreadPool* pPool = 0);
+
+	GraphTopology GetTopology() const
+	{
+		return m_topology;
+	}
 
 	std::vector<Edge>& GetEdges()
 	{
 		return m_edges;
 	}
+
+	const std::vector<Edge>& GetEdges() const
+	{
+		return m_edges;
+	}
+
+	//Including removed nodes, which keep their index
+	size_t GetNodeCount() const
+	{
+		return m_x.size();
+	}
+
+	//The edge list as 2 * GetEdges().size() vertex indices
+	const uint32_t* GetEdgeIndices() const
+	{
+		return m_edges.empty() ? 0 : &m_edges[0].i0;
+	}
+
+	//Incremental maintenance of the MST; other topologies are rebuilt
+	//in full and report every slot as dirty. An inserted node is linked to its
+	//nearest neighbours and each link replaces the longest edge on the
+	//cycle it closes; only the GRAPH_INSERT_CANDIDATES nearest are tried,
+	//so a far-reaching MST edge can be missed until the next ConnectMST.
+	//Removal reconnects the orphaned subtrees exactly. Node indices stay
+	//stable; removed nodes are left in place and skipped.
+	unsigned int InsertNode(const vmath::vec3& v);
+	void RemoveNode(unsigned int idx);
+
+	//Renumbers the nodes so that node order[i] becomes node i, for example
+	//into Morton order, and rebuilds the index and the current topology.
+	//Every edge slot is reported dirty.
+	void Permute(const std::vector<uint32_t>& order, ThreadPool* pPool = 0);
+
+	bool IsRemoved(unsigned int idx) const
+	{
+		return m_removed[idx];
+	}
+
+	//One flag per node, for saving alongside the edges
+	const std::vector<char>& GetRemoved() const
+	{
+		return m_removed;
+	}
+
+	//k of the last ConnectKNN
+	unsigned int GetKNN() const
+	{
+		return m_knn;
+	}
+
+	//Puts back saved edges of topology, without rebuilding them. removed
+	//holds a flag per node, as from GetRemoved.
+	void RestoreEdges(const Edge* edges, size_t count, const char* removed,
+			  GraphTopology topology, unsigned int k, ThreadPool* pPool = 0);
+
+	vmath::vec3 GetPosition(unsigned int idx) const
+	{
+		return vmath::vec3(m_x[idx], m_y[idx], m_z[idx]);
+	}
+
+	//Edge slots written since the last ClearDirtyEdges. Removing an edge
+	//moves the last edge into its slot, so slots at or past
+	//GetEdges().size() have simply been dropped.
+	const std::vector<unsigned int>& GetDirtyEdges() const
+	{
+		return m_dirty;
+	}
+
+	void ClearDirtyEdges()
+	{
+		m_dirty.clear();
+	}
 private:
+	float EdgeLength2(unsigned int a, unsigned int b)
+	{
+		float dx = m_x[a] - m_x[b], dy = m_y[a] - m_y[b], dz = m_z[a] - m_z[b];
+		return dx * dx + dy * dy + dz * dz;
+	}
+
+	void RefreshIndex(ThreadPool* pPool);
+	void ResetEdges(ThreadPool* pPool);
+	void ConnectEmptyRegion(bool bRelative, ThreadPool* pPool);
+	void Reconnect(ThreadPool* pPool = 0);
+	bool EdgeLess(unsigned int a0, unsigned int a1, unsigned int b0, unsigned int b1);
+	void AddEdge(unsigned int a, unsigned int b);
+	void RemoveEdge(unsigned int slot);
+	void BuildAdjacency();
+	void NearestLive(const vmath::vec3& v, unsigned int k, std::vector<KDNeighbour>& out);
+	void ScanPending(const vmath::vec3& v);
+	long MaxEdgeOnPath(unsigned int from, unsigned int to);
+	void UpdateMemory();
+
 	std::vector<Edge> m_edges;
-	std::vector<Node> m_nodes;
+	std::vector<float> m_x, m_y, m_z; //Node positions
+	std::vector<char> m_removed;
+	size_t m_livecount;
+	GraphTopology m_topology;
+	unsigned int m_knn;
+	KDTree m_tree;
+
+	//Incremental state: tree adjacency as edge slots, the same tree as a
+	//link-cut forest for cycle maxima, the first node inserted since the
+	//k-d tree was built, and scratch for searches
+	std::vector<std::vector<unsigned int>> m_adj;
+	LinkCutForest m_forest;
+	std::vector<uint32_t> m_nodelc, m_edgelc;
+	size_t m_pendingfirst;
+	std::vector<float> m_scratch;
+	std::vector<unsigned int> m_dirty;
+	std::vector<unsigned int> m_stamp, m_from;
+	unsigned int m_stampgen;
+
+	MemCounter m_nodemem, m_edgemem;
 };
 
 #endif
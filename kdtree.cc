@@ -0,0 +1,725 @@
+#include "kdtree.h"
+#include "threadpool.h"
+#include "ssemath.h"
+#include <algorithm>
+#include <cmath>
+
+KDTree::KDTree() :
+	m_depth(0),
+	m_mem("Spatial index")
+{
+}
+
+void KDTree::Build(const vmath::vec3* points, size_t count, ThreadPool* pPool,
+		   const uint32_t* ids)
+{
+	m_depth = 0;
+	while(((count + (1ul << m_depth) - 1) >> m_depth) > KD_LEAF_SIZE)
+	{
+		++m_depth;
+	}
+
+	std::vector<uint32_t> order(count);
+	for(size_t i = 0; i < count; ++i)
+	{
+		order[i] = i;
+	}
+
+	m_bounds.resize((2ul << m_depth) - 1);
+
+	//The top levels are split serially until there are enough independent
+	//subtrees to keep every thread busy
+	int deferdepth = 0;
+	if(pPool)
+	{
+		while((1u << deferdepth) < 4 * pPool->GetThreadCount() && deferdepth < m_depth)
+		{
+			++deferdepth;
+		}
+	}
+
+	std::vector<Subtree> deferred;
+	BuildNode(0, 0, count, 0, order, points, ids, deferdepth, pPool ? &deferred : 0);
+	if(pPool)
+	{
+		pPool->ParallelFor(0, deferred.size(), 1,
+				   [this, &deferred, &order, points, ids](size_t first, size_t last)
+				   {
+					   for(size_t i = first; i < last; ++i)
+					   {
+						   const Subtree& sub = deferred[i];
+						   BuildNode(sub.node, sub.lo, sub.hi, sub.depth,
+							     order, points, ids, 0, 0);
+					   }
+				   });
+	}
+
+	m_x.resize(count);
+	m_y.resize(count);
+	m_z.resize(count);
+	auto gather = [this, &order, points](size_t first, size_t last)
+	{
+		for(size_t i = first; i < last; ++i)
+		{
+			const vmath::vec3& p = points[order[i]];
+			m_x[i] = p[0];
+			m_y[i] = p[1];
+			m_z[i] = p[2];
+		}
+	};
+	if(pPool)
+	{
+		pPool->ParallelFor(0, count, 65536, gather);
+	}
+	else
+	{
+		gather(0, count);
+	}
+	if(ids)
+	{
+		for(size_t i = 0; i < count; ++i)
+		{
+			order[i] = ids[order[i]];
+		}
+	}
+	m_index.swap(order);
+
+	m_mem.SetCPU((m_x.capacity() + m_y.capacity() + m_z.capacity()) * sizeof(float) +
+		     m_index.capacity() * sizeof(uint32_t) +
+		     m_bounds.capacity() * sizeof(Bounds));
+}
+
+void KDTree::BuildNode(size_t node, size_t lo, size_t hi, int depth,
+		       std::vector<uint32_t>& order, const vmath::vec3* points,
+		       const uint32_t* ids, int deferdepth, std::vector<Subtree>* pDeferred)
+{
+	if(pDeferred && depth == deferdepth)
+	{
+		pDeferred->push_back(Subtree{node, lo, hi, depth});
+		return;
+	}
+
+	Bounds& box = m_bounds[node];
+	for(int d = 0; d < 3; ++d)
+	{
+		box.min[d] = INFINITY;
+		box.max[d] = -INFINITY;
+	}
+	for(size_t i = lo; i < hi; ++i)
+	{
+		const vmath::vec3& p = points[order[i]];
+		for(int d = 0; d < 3; ++d)
+		{
+			box.min[d] = std::min(box.min[d], p[d]);
+			box.max[d] = std::max(box.max[d], p[d]);
+		}
+	}
+
+	if(depth == m_depth)
+	{
+		//Leaves are kept in original index order so that the lowest
+		//position among equally near points is also the lowest index
+		std::sort(order.begin() + lo, order.begin() + hi,
+			  [ids](uint32_t a, uint32_t b)
+			  {
+				  return ids ? ids[a] < ids[b] : a < b;
+			  });
+		return;
+	}
+
+	//Split the widest axis at the median
+	int dim = 0;
+	for(int d = 1; d < 3; ++d)
+	{
+		if(box.max[d] - box.min[d] > box.max[dim] - box.min[dim])
+		{
+			dim = d;
+		}
+	}
+
+	size_t mid = lo + (hi - lo) / 2;
+	std::nth_element(order.begin() + lo, order.begin() + mid, order.begin() + hi,
+			 [points, dim](uint32_t a, uint32_t b)
+			 {
+				 return points[a][dim] < points[b][dim];
+			 });
+
+	BuildNode(2 * node + 1, lo, mid, depth + 1, order, points, ids, deferdepth, pDeferred);
+	BuildNode(2 * node + 2, mid, hi, depth + 1, order, points, ids, deferdepth, pDeferred);
+}
+
+float KDTree::BoxDistance2(const Bounds& box, float x, float y, float z) const
+{
+	float dx = std::max(std::max(box.min[0] - x, x - box.max[0]), 0.f);
+	float dy = std::max(std::max(box.min[1] - y, y - box.max[1]), 0.f);
+	float dz = std::max(std::max(box.min[2] - z, z - box.max[2]), 0.f);
+	return dx * dx + dy * dy + dz * dz;
+}
+
+static uint32_t LabelNode(size_t node, size_t lo, size_t hi, int depth, int maxdepth,
+			  const uint32_t* labels, uint32_t* nodelabels)
+{
+	uint32_t label = KD_NO_LABEL;
+	if(depth == maxdepth)
+	{
+		if(lo < hi)
+		{
+			label = labels[lo];
+			for(size_t i = lo + 1; i < hi && label != KD_NO_LABEL; ++i)
+			{
+				if(labels[i] != label)
+				{
+					label = KD_NO_LABEL;
+				}
+			}
+		}
+	}
+	else
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		uint32_t left = LabelNode(2 * node + 1, lo, mid, depth + 1, maxdepth,
+					  labels, nodelabels);
+		uint32_t right = LabelNode(2 * node + 2, mid, hi, depth + 1, maxdepth,
+					   labels, nodelabels);
+		label = (left == right) ? left : KD_NO_LABEL;
+	}
+	nodelabels[node] = label;
+	return label;
+}
+
+void KDTree::LabelNodes(const uint32_t* labels, std::vector<uint32_t>& nodelabels) const
+{
+	nodelabels.resize(m_bounds.size());
+	LabelNode(0, 0, m_index.size(), 0, m_depth, labels, &nodelabels[0]);
+}
+
+long KDTree::NearestOtherLabel(size_t pos, const uint32_t* labels,
+			       const uint32_t* nodelabels, float* bestd2) const
+{
+	long best = -1;
+	NearestOtherLabel(0, 0, m_index.size(), 0, pos, labels, nodelabels,
+			  bestd2, &best);
+	return best;
+}
+
+void KDTree::NearestOtherLabel(size_t node, size_t lo, size_t hi, int depth,
+			       size_t pos, const uint32_t* labels,
+			       const uint32_t* nodelabels,
+			       float* bestd2, long* best) const
+{
+	const uint32_t label = labels[pos];
+	const float x = m_x[pos], y = m_y[pos], z = m_z[pos];
+	if(nodelabels[node] == label || BoxDistance2(m_bounds[node], x, y, z) > *bestd2)
+	{
+		return;
+	}
+
+	if(depth == m_depth)
+	{
+		float d2 = *bestd2;
+		long i = ArgMinDistance2(&m_x[lo], &m_y[lo], &m_z[lo], hi - lo, x, y, z,
+					 &labels[lo], label, &d2);
+		if(i >= 0 &&
+		   (d2 < *bestd2 || *best < 0 || m_index[lo + i] < m_index[*best]))
+		{
+			*bestd2 = d2;
+			*best = lo + i;
+		}
+		return;
+	}
+
+	size_t mid = lo + (hi - lo) / 2;
+	size_t left = 2 * node + 1, right = 2 * node + 2;
+	float dleft = BoxDistance2(m_bounds[left], x, y, z);
+	float dright = BoxDistance2(m_bounds[right], x, y, z);
+	if(dleft <= dright)
+	{
+		NearestOtherLabel(left, lo, mid, depth + 1, pos, labels, nodelabels, bestd2, best);
+		NearestOtherLabel(right, mid, hi, depth + 1, pos, labels, nodelabels, bestd2, best);
+	}
+	else
+	{
+		NearestOtherLabel(right, mid, hi, depth + 1, pos, labels, nodelabels, bestd2, best);
+		NearestOtherLabel(left, lo, mid, depth + 1, pos, labels, nodelabels, bestd2, best);
+	}
+}
+
+long KDTree::NearestUnskipped(const vmath::vec3& q, const char* skip, float* bestd2) const
+{
+	long best = -1;
+	if(!m_index.empty())
+	{
+		NearestUnskipped(0, 0, m_index.size(), 0, q[0], q[1], q[2], skip, bestd2, &best);
+	}
+	return best;
+}
+
+void KDTree::NearestUnskipped(size_t node, size_t lo, size_t hi, int depth,
+			      float x, float y, float z, const char* skip,
+			      float* bestd2, long* best) const
+{
+	if(BoxDistance2(m_bounds[node], x, y, z) > *bestd2)
+	{
+		return;
+	}
+
+	if(depth == m_depth)
+	{
+		float d2[KD_LEAF_SIZE];
+		Distance2Batch(&m_x[lo], &m_y[lo], &m_z[lo], hi - lo, x, y, z, d2);
+		for(size_t i = lo; i < hi; ++i)
+		{
+			float dist = d2[i - lo];
+			if(skip[m_index[i]] || dist > *bestd2)
+			{
+				continue;
+			}
+			if(dist < *bestd2 || *best < 0 || m_index[i] < *best)
+			{
+				*bestd2 = dist;
+				*best = m_index[i];
+			}
+		}
+		return;
+	}
+
+	size_t mid = lo + (hi - lo) / 2;
+	size_t left = 2 * node + 1, right = 2 * node + 2;
+	if(BoxDistance2(m_bounds[left], x, y, z) <= BoxDistance2(m_bounds[right], x, y, z))
+	{
+		NearestUnskipped(left, lo, mid, depth + 1, x, y, z, skip, bestd2, best);
+		NearestUnskipped(right, mid, hi, depth + 1, x, y, z, skip, bestd2, best);
+	}
+	else
+	{
+		NearestUnskipped(right, mid, hi, depth + 1, x, y, z, skip, bestd2, best);
+		NearestUnskipped(left, lo, mid, depth + 1, x, y, z, skip, bestd2, best);
+	}
+}
+
+long KDTree::Nearest(const vmath::vec3& q, float* pd2, float eps) const
+{
+	std::vector<KDNeighbour> result;
+	KNearest(q, 1, result, eps);
+	if(result.empty())
+	{
+		return -1;
+	}
+	if(pd2)
+	{
+		*pd2 = result[0].d2;
+	}
+	return result[0].index;
+}
+
+void KDTree::KNearest(const vmath::vec3& q, unsigned int k,
+		      std::vector<KDNeighbour>& out, float eps,
+		      const char* skip) const
+{
+	out.clear();
+	if(!k || m_index.empty())
+	{
+		return;
+	}
+	out.reserve(k);
+	float epsscale = (1.f + eps) * (1.f + eps);
+	KNearest(0, 0, m_index.size(), 0, q[0], q[1], q[2], k, epsscale, skip, out);
+	std::sort_heap(out.begin(), out.end());
+}
+
+void KDTree::KNearest(size_t node, size_t lo, size_t hi, int depth,
+		      float x, float y, float z, unsigned int k, float epsscale,
+		      const char* skip, std::vector<KDNeighbour>& heap) const
+{
+	//heap is a max-heap on (distance, index) holding the best k so far
+	if(heap.size() == k &&
+	   BoxDistance2(m_bounds[node], x, y, z) * epsscale > heap.front().d2)
+	{
+		return;
+	}
+
+	if(depth == m_depth)
+	{
+		float d2[KD_LEAF_SIZE];
+		Distance2Batch(&m_x[lo], &m_y[lo], &m_z[lo], hi - lo, x, y, z, d2);
+		for(size_t i = lo; i < hi; ++i)
+		{
+			if(skip && skip[m_index[i]])
+			{
+				continue;
+			}
+			KDNeighbour n = {d2[i - lo], m_index[i]};
+			if(heap.size() < k)
+			{
+				heap.push_back(n);
+				std::push_heap(heap.begin(), heap.end());
+			}
+			else if(n < heap.front())
+			{
+				std::pop_heap(heap.begin(), heap.end());
+				heap.back() = n;
+				std::push_heap(heap.begin(), heap.end());
+			}
+		}
+		return;
+	}
+
+	size_t mid = lo + (hi - lo) / 2;
+	size_t left = 2 * node + 1, right = 2 * node + 2;
+	if(BoxDistance2(m_bounds[left], x, y, z) <= BoxDistance2(m_bounds[right], x, y, z))
+	{
+		KNearest(left, lo, mid, depth + 1, x, y, z, k, epsscale, skip, heap);
+		KNearest(right, mid, hi, depth + 1, x, y, z, k, epsscale, skip, heap);
+	}
+	else
+	{
+		KNearest(right, mid, hi, depth + 1, x, y, z, k, epsscale, skip, heap);
+		KNearest(left, lo, mid, depth + 1, x, y, z, k, epsscale, skip, heap);
+	}
+}
+
+void KDTree::KNearestBatch(const vmath::vec3* queries, size_t count, unsigned int k,
+			   std::vector<KDNeighbour>& out, ThreadPool* pPool,
+			   float eps) const
+{
+	out.resize(count * k);
+	auto batch = [this, queries, k, eps, &out](size_t first, size_t last)
+	{
+		std::vector<KDNeighbour> result;
+		for(size_t i = first; i < last; ++i)
+		{
+			KNearest(queries[i], k, result, eps);
+			KDNeighbour* pOut = &out[i * k];
+			for(unsigned int j = 0; j < k; ++j)
+			{
+				if(j < result.size())
+				{
+					pOut[j] = result[j];
+				}
+				else
+				{
+					pOut[j].d2 = INFINITY;
+					pOut[j].index = KD_NO_INDEX;
+				}
+			}
+		}
+	};
+
+	if(pPool)
+	{
+		pPool->ParallelFor(0, count, 1024, batch);
+	}
+	else
+	{
+		batch(0, count);
+	}
+}
+
+void KDTree::Radius(const vmath::vec3& q, float radius, std::vector<uint32_t>& out) const
+{
+	if(m_index.empty())
+	{
+		return;
+	}
+	Radius(0, 0, m_index.size(), 0, q[0], q[1], q[2], radius * radius, false, out);
+}
+
+void KDTree::RadiusPositions(size_t pos, float radius, std::vector<uint32_t>& out) const
+{
+	Radius(0, 0, m_index.size(), 0, m_x[pos], m_y[pos], m_z[pos], radius * radius, true, out);
+}
+
+size_t KDTree::CountRadius(size_t pos, float radius, size_t limit) const
+{
+	return CountRadius(0, 0, m_index.size(), 0, m_x[pos], m_y[pos], m_z[pos],
+			   radius * radius, limit, 0);
+}
+
+size_t KDTree::CountRadius(size_t node, size_t lo, size_t hi, int depth,
+			   float x, float y, float z, float r2, size_t limit, size_t count) const
+{
+	const Bounds& box = m_bounds[node];
+	if(count >= limit || BoxDistance2(box, x, y, z) > r2)
+	{
+		return count;
+	}
+
+	const float q[3] = {x, y, z};
+	float far2 = 0.f;
+	for(int d = 0; d < 3; ++d)
+	{
+		float extent = std::max(q[d] - box.min[d], box.max[d] - q[d]);
+		far2 += extent * extent;
+	}
+	if(far2 <= r2)
+	{
+		return count + (hi - lo);
+	}
+
+	if(depth == m_depth)
+	{
+		float d2[KD_LEAF_SIZE];
+		Distance2Batch(&m_x[lo], &m_y[lo], &m_z[lo], hi - lo, x, y, z, d2);
+		for(size_t i = lo; i < hi; ++i)
+		{
+			count += d2[i - lo] <= r2;
+		}
+		return count;
+	}
+
+	//Nearer child first to reach the limit sooner
+	size_t mid = lo + (hi - lo) / 2;
+	size_t left = 2 * node + 1, right = 2 * node + 2;
+	if(BoxDistance2(m_bounds[left], x, y, z) > BoxDistance2(m_bounds[right], x, y, z))
+	{
+		count = CountRadius(right, mid, hi, depth + 1, x, y, z, r2, limit, count);
+		return CountRadius(left, lo, mid, depth + 1, x, y, z, r2, limit, count);
+	}
+	count = CountRadius(left, lo, mid, depth + 1, x, y, z, r2, limit, count);
+	return CountRadius(right, mid, hi, depth + 1, x, y, z, r2, limit, count);
+}
+
+void KDTree::Radius(size_t node, size_t lo, size_t hi, int depth,
+		    float x, float y, float z, float r2, bool bPositions,
+		    std::vector<uint32_t>& out) const
+{
+	const Bounds& box = m_bounds[node];
+	if(BoxDistance2(box, x, y, z) > r2)
+	{
+		return;
+	}
+
+	//A box wholly inside the ball is taken without testing its points
+	const float q[3] = {x, y, z};
+	float far2 = 0.f;
+	for(int d = 0; d < 3; ++d)
+	{
+		float extent = std::max(q[d] - box.min[d], box.max[d] - q[d]);
+		far2 += extent * extent;
+	}
+	if(far2 <= r2)
+	{
+		for(size_t i = lo; i < hi; ++i)
+		{
+			out.push_back(bPositions ? i : m_index[i]);
+		}
+		return;
+	}
+
+	if(depth == m_depth)
+	{
+		float d2[KD_LEAF_SIZE];
+		Distance2Batch(&m_x[lo], &m_y[lo], &m_z[lo], hi - lo, x, y, z, d2);
+		for(size_t i = lo; i < hi; ++i)
+		{
+			if(d2[i - lo] <= r2)
+			{
+				out.push_back(bPositions ? i : m_index[i]);
+			}
+		}
+		return;
+	}
+
+	size_t mid = lo + (hi - lo) / 2;
+	Radius(2 * node + 1, lo, mid, depth + 1, x, y, z, r2, bPositions, out);
+	Radius(2 * node + 2, mid, hi, depth + 1, x, y, z, r2, bPositions, out);
+}
+
+void KDTree::EmptyRegionNeighbours(size_t pos, bool bRelative, std::vector<uint32_t>& out) const
+{
+	struct Entry
+	{
+		float d2;
+		uint32_t node, lo, hi; //node is KD_NO_INDEX for the point at lo
+		int depth;
+
+		bool operator>(const Entry& other) const
+		{
+			return d2 > other.d2;
+		}
+	};
+
+	//Scratch kept per thread as this runs once for every point
+	static thread_local std::vector<Entry> heap;
+	static thread_local std::vector<uint32_t> accepted, rejected;
+	heap.clear();
+	accepted.clear();
+	rejected.clear();
+
+	const float x = m_x[pos], y = m_y[pos], z = m_z[pos];
+	auto push = [](const Entry& e)
+	{
+		heap.push_back(e);
+		std::push_heap(heap.begin(), heap.end(), std::greater<Entry>());
+	};
+	push(Entry{0.f, 0, 0, (uint32_t) m_index.size(), 0});
+
+	//r shadows everything beyond the plane through r facing p: a point q
+	//there has r inside its diametral ball, (q - r).(p - r) < 0
+	auto shadows = [this, x, y, z](uint32_t r, float tx, float ty, float tz)
+	{
+		float dx = x - m_x[r], dy = y - m_y[r], dz = z - m_z[r];
+		return (tx - m_x[r]) * dx + (ty - m_y[r]) * dy + (tz - m_z[r]) * dz < 0.f;
+	};
+	auto boxshadowed = [this, x, y, z](uint32_t r, const Bounds& box)
+	{
+		const float p[3] = {x, y, z}, c[3] = {m_x[r], m_y[r], m_z[r]};
+		float most = 0.f;
+		for(int d = 0; d < 3; ++d)
+		{
+			float dir = p[d] - c[d];
+			most += std::max((box.min[d] - c[d]) * dir, (box.max[d] - c[d]) * dir);
+		}
+		return most < 0.f;
+	};
+
+	while(!heap.empty())
+	{
+		std::pop_heap(heap.begin(), heap.end(), std::greater<Entry>());
+		Entry e = heap.back();
+		heap.pop_back();
+
+		if(e.node != KD_NO_INDEX)
+		{
+			const Bounds& box = m_bounds[e.node];
+			bool bHidden = false;
+			for(size_t i = 0; i < accepted.size() && !bHidden; ++i)
+			{
+				bHidden = boxshadowed(accepted[i], box);
+			}
+			for(size_t i = 0; i < rejected.size() && !bHidden; ++i)
+			{
+				bHidden = boxshadowed(rejected[i], box);
+			}
+			if(bHidden)
+			{
+				continue;
+			}
+
+			if(e.depth == m_depth)
+			{
+				float d2[KD_LEAF_SIZE];
+				Distance2Batch(&m_x[e.lo], &m_y[e.lo], &m_z[e.lo], e.hi - e.lo, x, y, z, d2);
+				for(uint32_t i = e.lo; i < e.hi; ++i)
+				{
+					bool bShadowed = false;
+					for(size_t a = 0; a < accepted.size() && !bShadowed; ++a)
+					{
+						bShadowed = shadows(accepted[a], m_x[i], m_y[i], m_z[i]);
+					}
+					if(i != pos && !bShadowed)
+					{
+						push(Entry{d2[i - e.lo], KD_NO_INDEX, i, i, e.depth});
+					}
+				}
+				continue;
+			}
+
+			uint32_t mid = e.lo + (e.hi - e.lo) / 2;
+			uint32_t left = 2 * e.node + 1, right = 2 * e.node + 2;
+			push(Entry{BoxDistance2(m_bounds[left], x, y, z), left, e.lo, mid, e.depth + 1});
+			push(Entry{BoxDistance2(m_bounds[right], x, y, z), right, mid, e.hi, e.depth + 1});
+			continue;
+		}
+
+		//Points seen so far are cheap to test and usually block q. A
+		//blocker can still hide in a pruned box, as it only had to be
+		//shadowed itself, so acceptance needs an exact check on the tree.
+		uint32_t q = e.lo;
+		const float tx = m_x[q], ty = m_y[q], tz = m_z[q];
+		bool bBlocked = false;
+		for(size_t i = 0; i < accepted.size() && !bBlocked; ++i)
+		{
+			bBlocked = shadows(accepted[i], tx, ty, tz);
+		}
+		for(size_t i = 0; i < rejected.size() && !bBlocked; ++i)
+		{
+			bBlocked = shadows(rejected[i], tx, ty, tz);
+		}
+		if(bBlocked || AnyInRegion(0, 0, m_index.size(), 0, pos, q, e.d2, false))
+		{
+			rejected.push_back(q);
+			continue;
+		}
+
+		accepted.push_back(q);
+		if(bRelative)
+		{
+			//The same again for the lune, whose blockers are all nearer to
+			//p than q is and so mostly seen already
+			auto inlune = [this, x, y, z, tx, ty, tz, &e](uint32_t r)
+			{
+				float ax = m_x[r] - x, ay = m_y[r] - y, az = m_z[r] - z;
+				float bx = m_x[r] - tx, by = m_y[r] - ty, bz = m_z[r] - tz;
+				return ax * ax + ay * ay + az * az < e.d2 &&
+					bx * bx + by * by + bz * bz < e.d2;
+			};
+			bool bLuneBlocked = false;
+			for(size_t i = 0; i < rejected.size() && !bLuneBlocked; ++i)
+			{
+				bLuneBlocked = inlune(rejected[i]);
+			}
+			for(size_t i = 0; i + 1 < accepted.size() && !bLuneBlocked; ++i)
+			{
+				bLuneBlocked = inlune(accepted[i]);
+			}
+			if(bLuneBlocked || AnyInRegion(0, 0, m_index.size(), 0, pos, q, e.d2, true))
+			{
+				continue;
+			}
+		}
+		out.push_back(m_index[q]);
+	}
+}
+
+bool KDTree::AnyInRegion(size_t node, size_t lo, size_t hi, int depth,
+			 size_t p, size_t q, float d2, bool bLune) const
+{
+	//Gabriel: strictly inside the ball on diameter pq, (r - p).(r - q) < 0.
+	//Lune: strictly nearer to both p and q than d2. Boxes are rejected
+	//conservatively, the exact test is made per point.
+	const Bounds& box = m_bounds[node];
+	if(bLune)
+	{
+		if(BoxDistance2(box, m_x[p], m_y[p], m_z[p]) >= d2 ||
+		   BoxDistance2(box, m_x[q], m_y[q], m_z[q]) >= d2)
+		{
+			return false;
+		}
+	}
+	else
+	{
+		float cx = (m_x[p] + m_x[q]) * 0.5f;
+		float cy = (m_y[p] + m_y[q]) * 0.5f;
+		float cz = (m_z[p] + m_z[q]) * 0.5f;
+		if(BoxDistance2(box, cx, cy, cz) > d2 * 0.2501f)
+		{
+			return false;
+		}
+	}
+
+	if(depth == m_depth)
+	{
+		for(size_t i = lo; i < hi; ++i)
+		{
+			if(i == p || i == q)
+			{
+				continue;
+			}
+			float ax = m_x[i] - m_x[p], ay = m_y[i] - m_y[p], az = m_z[i] - m_z[p];
+			float bx = m_x[i] - m_x[q], by = m_y[i] - m_y[q], bz = m_z[i] - m_z[q];
+			bool bInside = bLune ?
+				(ax * ax + ay * ay + az * az < d2 && bx * bx + by * by + bz * bz < d2) :
+				(ax * bx + ay * by + az * bz < 0.f);
+			if(bInside)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	size_t mid = lo + (hi - lo) / 2;
+	return AnyInRegion(2 * node + 1, lo, mid, depth + 1, p, q, d2, bLune) ||
+		AnyInRegion(2 * node + 2, mid, hi, depth + 1, p, q, d2, bLune);
+}
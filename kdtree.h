@@ -0,0 +1,144 @@
+#ifndef KDTREE_H_
+#define KDTREE_H_
+#include <vector>
+#include <cstdint>
+#include "vmath.h"
+#include "memstats.h"
+
+#define KD_LEAF_SIZE 16
+#define KD_NO_LABEL 0xFFFFFFFFu
+#define KD_NO_INDEX 0xFFFFFFFFu
+
+class ThreadPool;
+
+struct KDNeighbour
+{
+	float d2;
+	uint32_t index;
+
+	bool operator<(const KDNeighbour& other) const
+	{
+		return d2 < other.d2 || (d2 == other.d2 && index < other.index);
+	}
+};
+
+//Static k-d tree over 3D points. The tree is implicit: node i has
+//children 2i+1 and 2i+2 and every node at the bottom level is a bucket
+//of at most KD_LEAF_SIZE points. Points are stored permuted into tree
+//order as separate x/y/z arrays so that each bucket is contiguous.
+//Queries return original point indices. An eps > 0 makes nearest
+//neighbour queries approximate: results are within (1 + eps) of the
+//true distances.
+class KDTree
+{
+public:
+	KDTree();
+
+	//ids, when given, supplies the index reported for each point in place
+	//of its position in the points array
+	void Build(const vmath::vec3* points, size_t count, ThreadPool* pPool = 0,
+		   const uint32_t* ids = 0);
+
+	long Nearest(const vmath::vec3& q, float* pd2 = 0, float eps = 0.f) const;
+
+	//Up to k neighbours sorted by distance. Points whose original index is
+	//flagged in skip are ignored.
+	void KNearest(const vmath::vec3& q, unsigned int k,
+		      std::vector<KDNeighbour>& out, float eps = 0.f,
+		      const char* skip = 0) const;
+
+	//k neighbours for each query, stored in out[i * k .. i * k + k). Slots
+	//without a neighbour hold KD_NO_INDEX at infinite distance.
+	void KNearestBatch(const vmath::vec3* queries, size_t count, unsigned int k,
+			   std::vector<KDNeighbour>& out, ThreadPool* pPool = 0,
+			   float eps = 0.f) const;
+
+	//Appends every point within radius of q, in no particular order
+	void Radius(const vmath::vec3& q, float radius, std::vector<uint32_t>& out) const;
+	//The same around the point at tree position pos, itself included,
+	//appending tree positions
+	void RadiusPositions(size_t pos, float radius, std::vector<uint32_t>& out) const;
+	//Number of points within radius of tree position pos, itself included,
+	//stopping once it reaches limit
+	size_t CountRadius(size_t pos, float radius, size_t limit) const;
+
+	size_t Size() const
+	{
+		return m_index.size();
+	}
+
+	//Original index of the point stored at tree position pos
+	uint32_t GetIndex(size_t pos) const
+	{
+		return m_index[pos];
+	}
+
+	vmath::vec3 GetPoint(size_t pos) const
+	{
+		return vmath::vec3(m_x[pos], m_y[pos], m_z[pos]);
+	}
+
+	//Per-node label that is set when every point below a node carries the
+	//same label, KD_NO_LABEL otherwise. labels is indexed by tree position.
+	void LabelNodes(const uint32_t* labels, std::vector<uint32_t>& nodelabels) const;
+
+	//Nearest point to tree position pos whose label differs from its own.
+	//Only hits closer than *bestd2 (ties broken on the smaller original
+	//index) are reported; returns the tree position or -1.
+	long NearestOtherLabel(size_t pos, const uint32_t* labels,
+			       const uint32_t* nodelabels, float* bestd2) const;
+
+	//Nearest point to q whose original index is not flagged in skip, with
+	//the same *bestd2 bound and tie-break; returns the original index or -1
+	long NearestUnskipped(const vmath::vec3& q, const char* skip, float* bestd2) const;
+
+	//Gabriel neighbours of the point at tree position pos: every q whose
+	//diametral ball holds no other point. With bRelative only those whose
+	//lune (the points nearer to both p and q than they are to each other)
+	//is empty as well, which gives the relative neighbourhood graph.
+	//Candidates are visited nearest first and subtrees lying wholly in the
+	//half-space behind a point already seen, where every point has that
+	//one in its diametral ball, are pruned. Appends original indices.
+	void EmptyRegionNeighbours(size_t pos, bool bRelative, std::vector<uint32_t>& out) const;
+private:
+	struct Bounds
+	{
+		float min[3], max[3];
+	};
+
+	struct Subtree
+	{
+		size_t node, lo, hi;
+		int depth;
+	};
+
+	float BoxDistance2(const Bounds& box, float x, float y, float z) const;
+	void BuildNode(size_t node, size_t lo, size_t hi, int depth,
+		       std::vector<uint32_t>& order, const vmath::vec3* points,
+		       const uint32_t* ids, int deferdepth, std::vector<Subtree>* pDeferred);
+	void KNearest(size_t node, size_t lo, size_t hi, int depth,
+		      float x, float y, float z, unsigned int k, float epsscale,
+		      const char* skip, std::vector<KDNeighbour>& heap) const;
+	void Radius(size_t node, size_t lo, size_t hi, int depth,
+		    float x, float y, float z, float r2, bool bPositions,
+		    std::vector<uint32_t>& out) const;
+	size_t CountRadius(size_t node, size_t lo, size_t hi, int depth,
+			   float x, float y, float z, float r2, size_t limit, size_t count) const;
+	void NearestOtherLabel(size_t node, size_t lo, size_t hi, int depth,
+			       size_t pos, const uint32_t* labels,
+			       const uint32_t* nodelabels,
+			       float* bestd2, long* best) const;
+	bool AnyInRegion(size_t node, size_t lo, size_t hi, int depth,
+			 size_t p, size_t q, float d2, bool bLune) const;
+	void NearestUnskipped(size_t node, size_t lo, size_t hi, int depth,
+			      float x, float y, float z, const char* skip,
+			      float* bestd2, long* best) const;
+
+	std::vector<float> m_x, m_y, m_z;
+	std::vector<uint32_t> m_index;
+	std::vector<Bounds> m_bounds;
+	int m_depth;
+	MemCounter m_mem;
+};
+
+#endif
@@ -0,0 +1,219 @@
+#include "linkcut.h"
+#include <utility>
+
+uint32_t LinkCutForest::AddNode()
+{
+	LCNode node = {{LC_NONE, LC_NONE}, LC_NONE, LC_NONE, false, false, 0.f, 0, 0};
+	if(!m_free.empty())
+	{
+		uint32_t u = m_free.back();
+		m_free.pop_back();
+		m_nodes[u] = node;
+		return u;
+	}
+	m_nodes.push_back(node);
+	return m_nodes.size() - 1;
+}
+
+uint32_t LinkCutForest::AddNode(float d2, uint32_t lo, uint32_t hi)
+{
+	uint32_t u = AddNode();
+	LCNode& node = m_nodes[u];
+	node.bWeighted = true;
+	node.d2 = d2;
+	node.lo = lo;
+	node.hi = hi;
+	node.max = u;
+	return u;
+}
+
+void LinkCutForest::RemoveNode(uint32_t u)
+{
+	m_free.push_back(u);
+}
+
+void LinkCutForest::Clear()
+{
+	m_nodes.clear();
+	m_free.clear();
+}
+
+bool LinkCutForest::Heavier(uint32_t a, uint32_t b) const
+{
+	if(b == LC_NONE)
+	{
+		return a != LC_NONE;
+	}
+	if(a == LC_NONE)
+	{
+		return false;
+	}
+	const LCNode& x = m_nodes[a];
+	const LCNode& y = m_nodes[b];
+	if(x.d2 != y.d2)
+	{
+		return x.d2 > y.d2;
+	}
+	if(x.lo != y.lo)
+	{
+		return x.lo > y.lo;
+	}
+	return x.hi > y.hi;
+}
+
+bool LinkCutForest::IsSplayRoot(uint32_t u) const
+{
+	//The parent pointer of a splay root is the path-parent, which does not
+	//list u as a child
+	uint32_t p = m_nodes[u].parent;
+	return p == LC_NONE || (m_nodes[p].child[0] != u && m_nodes[p].child[1] != u);
+}
+
+void LinkCutForest::Push(uint32_t u)
+{
+	LCNode& node = m_nodes[u];
+	if(node.bReversed)
+	{
+		std::swap(node.child[0], node.child[1]);
+		for(int i = 0; i < 2; ++i)
+		{
+			if(node.child[i] != LC_NONE)
+			{
+				m_nodes[node.child[i]].bReversed ^= true;
+			}
+		}
+		node.bReversed = false;
+	}
+}
+
+void LinkCutForest::Pull(uint32_t u)
+{
+	LCNode& node = m_nodes[u];
+	node.max = node.bWeighted ? u : LC_NONE;
+	for(int i = 0; i < 2; ++i)
+	{
+		if(node.child[i] != LC_NONE && Heavier(m_nodes[node.child[i]].max, node.max))
+		{
+			node.max = m_nodes[node.child[i]].max;
+		}
+	}
+}
+
+void LinkCutForest::Rotate(uint32_t u)
+{
+	uint32_t p = m_nodes[u].parent;
+	uint32_t g = m_nodes[p].parent;
+	int side = m_nodes[p].child[1] == u;
+	uint32_t moved = m_nodes[u].child[side ^ 1];
+
+	if(!IsSplayRoot(p))
+	{
+		m_nodes[g].child[m_nodes[g].child[1] == p] = u;
+	}
+	m_nodes[u].parent = g;
+
+	m_nodes[p].child[side] = moved;
+	if(moved != LC_NONE)
+	{
+		m_nodes[moved].parent = p;
+	}
+	m_nodes[u].child[side ^ 1] = p;
+	m_nodes[p].parent = u;
+	Pull(p);
+	Pull(u);
+}
+
+void LinkCutForest::Splay(uint32_t u)
+{
+	//Reversal flags are pushed from the splay root down before rotating
+	m_stack.clear();
+	m_stack.push_back(u);
+	for(uint32_t x = u; !IsSplayRoot(x); x = m_nodes[x].parent)
+	{
+		m_stack.push_back(m_nodes[x].parent);
+	}
+	for(size_t i = m_stack.size(); i-- > 0;)
+	{
+		Push(m_stack[i]);
+	}
+
+	while(!IsSplayRoot(u))
+	{
+		uint32_t p = m_nodes[u].parent;
+		if(!IsSplayRoot(p))
+		{
+			uint32_t g = m_nodes[p].parent;
+			bool bZigZig = (m_nodes[g].child[0] == p) == (m_nodes[p].child[0] == u);
+			Rotate(bZigZig ? p : u);
+		}
+		Rotate(u);
+	}
+}
+
+void LinkCutForest::Access(uint32_t u)
+{
+	uint32_t last = LC_NONE;
+	for(uint32_t x = u; x != LC_NONE; x = m_nodes[x].parent)
+	{
+		Splay(x);
+		m_nodes[x].child[1] = last;
+		Pull(x);
+		last = x;
+	}
+	Splay(u);
+}
+
+void LinkCutForest::Evert(uint32_t u)
+{
+	Access(u);
+	m_nodes[u].bReversed ^= true;
+}
+
+uint32_t LinkCutForest::FindRoot(uint32_t u)
+{
+	Access(u);
+	uint32_t x = u;
+	for(;;)
+	{
+		Push(x);
+		if(m_nodes[x].child[0] == LC_NONE)
+		{
+			break;
+		}
+		x = m_nodes[x].child[0];
+	}
+	Splay(x);
+	return x;
+}
+
+void LinkCutForest::Link(uint32_t u, uint32_t v)
+{
+	Evert(u);
+	m_nodes[u].parent = v;
+}
+
+void LinkCutForest::Cut(uint32_t u, uint32_t v)
+{
+	Evert(u);
+	Access(v);
+	//v's splay tree now holds exactly the path u-v with u on its left
+	m_nodes[v].child[0] = LC_NONE;
+	m_nodes[u].parent = LC_NONE;
+	Pull(v);
+}
+
+bool LinkCutForest::Connected(uint32_t u, uint32_t v)
+{
+	return u == v || FindRoot(u) == FindRoot(v);
+}
+
+uint32_t LinkCutForest::PathMax(uint32_t u, uint32_t v)
+{
+	if(!Connected(u, v))
+	{
+		return LC_NONE;
+	}
+	Evert(u);
+	Access(v);
+	return m_nodes[v].max;
+}
@@ -0,0 +1,69 @@
+#ifndef LINKCUT_H_
+#define LINKCUT_H_
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#define LC_NONE 0xFFFFFFFFu
+
+//Forest of unrooted trees supporting link, cut and the heaviest node on a
+//path, each in O(log n) amortised time (Sleator-Tarjan link-cut trees over
+//splay trees). Weighted edges are modelled as nodes of their own sitting
+//between the two endpoints, so a path query over them finds the heaviest
+//edge. Weights are ordered by (d2, lo, hi) to make every key distinct.
+class LinkCutForest
+{
+public:
+	//Returns a new isolated node, reusing freed ones first
+	uint32_t AddNode();
+	uint32_t AddNode(float d2, uint32_t lo, uint32_t hi);
+	//The node must have been cut from everything already
+	void RemoveNode(uint32_t u);
+	void Clear();
+
+	//u and v must be in different trees
+	void Link(uint32_t u, uint32_t v);
+	//u and v must be adjacent
+	void Cut(uint32_t u, uint32_t v);
+	bool Connected(uint32_t u, uint32_t v);
+
+	//Heaviest weighted node on the path from u to v, LC_NONE if there is
+	//none or the two are not connected
+	uint32_t PathMax(uint32_t u, uint32_t v);
+
+	void GetEndpoints(uint32_t u, uint32_t* plo, uint32_t* phi) const
+	{
+		*plo = m_nodes[u].lo;
+		*phi = m_nodes[u].hi;
+	}
+
+	size_t GetMemoryUsage() const
+	{
+		return m_nodes.capacity() * sizeof(LCNode) +
+			m_free.capacity() * sizeof(uint32_t);
+	}
+private:
+	struct LCNode
+	{
+		uint32_t child[2], parent;
+		uint32_t max; //Heaviest weighted node in this splay subtree
+		bool bReversed, bWeighted;
+		float d2;
+		uint32_t lo, hi;
+	};
+
+	bool Heavier(uint32_t a, uint32_t b) const;
+	bool IsSplayRoot(uint32_t u) const;
+	void Push(uint32_t u);
+	void Pull(uint32_t u);
+	void Rotate(uint32_t u);
+	void Splay(uint32_t u);
+	void Access(uint32_t u);
+	void Evert(uint32_t u);
+	uint32_t FindRoot(uint32_t u);
+
+	std::vector<LCNode> m_nodes;
+	std::vector<uint32_t> m_free, m_stack;
+};
+
+#endif
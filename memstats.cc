@@ -0,0 +1,130 @@
+#include "memstats.h"
+#include <atomic>
+#include <mutex>
+#include <cstring>
+
+#define MEM_MAX_SUBSYSTEMS 64
+
+struct MemSubsystem
+{
+	char name[32];
+	std::atomic<long long> cpu, gpu, cpupeak, gpupeak;
+};
+
+static MemSubsystem g_memsubsystems[MEM_MAX_SUBSYSTEMS];
+static std::atomic<int> g_memsubsystemcount(0);
+static std::mutex g_memregisterlock;
+
+static void UpdatePeak(std::atomic<long long>& peak, long long value)
+{
+	long long prev = peak.load(std::memory_order_relaxed);
+	while(value > prev &&
+	      !peak.compare_exchange_weak(prev, value, std::memory_order_relaxed))
+	{
+	}
+}
+
+int MemRegisterSubsystem(const char* name)
+{
+	std::lock_guard<std::mutex> lock(g_memregisterlock);
+	int count = g_memsubsystemcount.load();
+	for(int i = 0; i < count; ++i)
+	{
+		if(!strncmp(g_memsubsystems[i].name, name, sizeof(g_memsubsystems[i].name) - 1))
+		{
+			return i;
+		}
+	}
+
+	if(count >= MEM_MAX_SUBSYSTEMS)
+	{
+		fprintf(stderr, "MemRegisterSubsystem: too many subsystems, folding '%s' into '%s'\n",
+			name, g_memsubsystems[count - 1].name);
+		return count - 1;
+	}
+
+	MemSubsystem& sub = g_memsubsystems[count];
+	strncpy(sub.name, name, sizeof(sub.name) - 1);
+	sub.cpu = 0;
+	sub.gpu = 0;
+	sub.cpupeak = 0;
+	sub.gpupeak = 0;
+	g_memsubsystemcount.store(count + 1);
+	return count;
+}
+
+void MemAdjust(int subsystem, long long cpudelta, long long gpudelta)
+{
+	MemSubsystem& sub = g_memsubsystems[subsystem];
+	if(cpudelta)
+	{
+		long long now = sub.cpu.fetch_add(cpudelta, std::memory_order_relaxed) + cpudelta;
+		UpdatePeak(sub.cpupeak, now);
+	}
+	if(gpudelta)
+	{
+		long long now = sub.gpu.fetch_add(gpudelta, std::memory_order_relaxed) + gpudelta;
+		UpdatePeak(sub.gpupeak, now);
+	}
+}
+
+void MemReport(FILE* fp)
+{
+	long long totals[4] = {0, 0, 0, 0};
+	const double kib = 1024.0;
+	fprintf(fp, "%-24s %12s %12s %12s %12s\n", "Subsystem (KiB)",
+		"CPU", "CPU peak", "GPU", "GPU peak");
+	for(int i = 0, z = g_memsubsystemcount.load(); i < z; ++i)
+	{
+		MemSubsystem& sub = g_memsubsystems[i];
+		long long vals[4] = {sub.cpu.load(), sub.cpupeak.load(),
+			sub.gpu.load(), sub.gpupeak.load()};
+		fprintf(fp, "%-24s %12.1f %12.1f %12.1f %12.1f\n", sub.name,
+			vals[0]/kib, vals[1]/kib, vals[2]/kib, vals[3]/kib);
+		for(int j = 0; j < 4; ++j)
+		{
+			totals[j] += vals[j];
+		}
+	}
+	//Summed peaks are an upper bound; subsystems need not peak together
+	fprintf(fp, "%-24s %12.1f %12.1f %12.1f %12.1f\n", "Total",
+		totals[0]/kib, totals[1]/kib, totals[2]/kib, totals[3]/kib);
+}
+
+MemCounter::MemCounter(const char* subsystem) :
+	m_subsystem(MemRegisterSubsystem(subsystem)),
+	m_cpubytes(0),
+	m_gpubytes(0)
+{
+}
+
+MemCounter::MemCounter(const MemCounter& other) :
+	m_subsystem(other.m_subsystem),
+	m_cpubytes(0),
+	m_gpubytes(0)
+{
+}
+
+MemCounter::~MemCounter()
+{
+	SetCPU(0);
+	SetGPU(0);
+}
+
+void MemCounter::SetCPU(size_t bytes)
+{
+	if(bytes != m_cpubytes)
+	{
+		MemAdjust(m_subsystem, (long long) bytes - (long long) m_cpubytes, 0);
+		m_cpubytes = bytes;
+	}
+}
+
+void MemCounter::SetGPU(size_t bytes)
+{
+	if(bytes != m_gpubytes)
+	{
+		MemAdjust(m_subsystem, 0, (long long) bytes - (long long) m_gpubytes);
+		m_gpubytes = bytes;
+	}
+}
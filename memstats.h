@@ -0,0 +1,33 @@
+#ifndef MEMSTATS_H_
+#define MEMSTATS_H_
+#include <cstddef>
+#include <cstdio>
+
+//Per-subsystem memory accounting. A subsystem is registered once by name
+//and every MemCounter belonging to it adds its CPU and GPU bytes to the
+//subsystem's running totals. Peaks are kept alongside the current values.
+int MemRegisterSubsystem(const char* name);
+void MemAdjust(int subsystem, long long cpudelta, long long gpudelta);
+void MemReport(FILE* fp = stdout);
+
+class MemCounter
+{
+public:
+	MemCounter(const char* subsystem);
+	MemCounter(const MemCounter& other);
+	~MemCounter();
+
+	MemCounter& operator=(const MemCounter&)
+	{
+		//The owner reports its own sizes; only the subsystem is shared
+		return *this;
+	}
+
+	void SetCPU(size_t bytes);
+	void SetGPU(size_t bytes);
+private:
+	int m_subsystem;
+	size_t m_cpubytes, m_gpubytes;
+};
+
+#endif
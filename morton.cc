@@ -0,0 +1,153 @@
+#include "morton.h"
+#include <algorithm>
+#include <functional>
+#include "threadpool.h"
+
+#define RADIX_CHUNK 65536
+
+static uint64_t SpreadBits(uint32_t v)
+{
+	//Moves bit i of the low 21 to bit 3i
+	uint64_t x = v & 0x1FFFFF;
+	x = (x | x << 32) & 0x1F00000000FFFFull;
+	x = (x | x << 16) & 0x1F0000FF0000FFull;
+	x = (x | x << 8) & 0x100F00F00F00F00Full;
+	x = (x | x << 4) & 0x10C30C30C30C30C3ull;
+	x = (x | x << 2) & 0x1249249249249249ull;
+	return x;
+}
+
+uint64_t MortonEncode(uint32_t x, uint32_t y, uint32_t z)
+{
+	return SpreadBits(x) | SpreadBits(y) << 1 | SpreadBits(z) << 2;
+}
+
+static void ForChunks(ThreadPool* pPool, size_t chunks,
+		      const std::function<void(size_t, size_t)>& fn)
+{
+	if(pPool)
+	{
+		pPool->ParallelFor(0, chunks, 1, fn);
+	}
+	else if(chunks)
+	{
+		fn(0, chunks);
+	}
+}
+
+void MortonOrder(const vmath::vec3* points, size_t count, std::vector<uint32_t>& order,
+		 ThreadPool* pPool)
+{
+	order.resize(count);
+	if(!count)
+	{
+		return;
+	}
+
+	vmath::vec3 lo = points[0], hi = points[0];
+	for(size_t i = 1; i < count; ++i)
+	{
+		for(int d = 0; d < 3; ++d)
+		{
+			lo[d] = std::min(lo[d], points[i][d]);
+			hi[d] = std::max(hi[d], points[i][d]);
+		}
+	}
+
+	//Quantise to 21 bits per axis over the bounding box
+	float scale[3];
+	for(int d = 0; d < 3; ++d)
+	{
+		float extent = hi[d] - lo[d];
+		scale[d] = extent > 0.f ? 2097151.f / extent : 0.f;
+	}
+	std::vector<uint64_t> keys(count);
+	size_t chunks = (count + RADIX_CHUNK - 1) / RADIX_CHUNK;
+	ForChunks(pPool, chunks, [&](size_t first, size_t last)
+		  {
+			  for(size_t i = first * RADIX_CHUNK; i < std::min(last * RADIX_CHUNK, count); ++i)
+			  {
+				  uint32_t q[3];
+				  for(int d = 0; d < 3; ++d)
+				  {
+					  q[d] = std::min((points[i][d] - lo[d]) * scale[d], 2097151.f);
+				  }
+				  keys[i] = MortonEncode(q[0], q[1], q[2]);
+				  order[i] = i;
+			  }
+		  });
+	RadixSort(keys, order, pPool);
+}
+
+void RadixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, ThreadPool* pPool)
+{
+	size_t count = keys.size();
+	if(count < 2)
+	{
+		return;
+	}
+
+	uint64_t anykey = keys[0], varying = 0;
+	for(uint64_t key : keys)
+	{
+		varying |= key ^ anykey;
+	}
+
+	size_t chunks = (count + RADIX_CHUNK - 1) / RADIX_CHUNK;
+	std::vector<uint64_t> keysout(count);
+	std::vector<uint32_t> valuesout(count);
+	//offsets[chunk * 256 + digit]: counts, then where that chunk's digit
+	//run starts in the output
+	std::vector<size_t> offsets(chunks * 256);
+
+	for(int shift = 0; shift < 64; shift += 8)
+	{
+		if(!((varying >> shift) & 0xFF))
+		{
+			continue;
+		}
+
+		ForChunks(pPool, chunks, [&](size_t first, size_t last)
+			  {
+				  for(size_t c = first; c < last; ++c)
+				  {
+					  size_t* counts = &offsets[c * 256];
+					  std::fill(counts, counts + 256, 0);
+					  size_t end = std::min((c + 1) * RADIX_CHUNK, count);
+					  for(size_t i = c * RADIX_CHUNK; i < end; ++i)
+					  {
+						  ++counts[(keys[i] >> shift) & 0xFF];
+					  }
+				  }
+			  });
+
+		//Digit major, chunk minor keeps equal digits in input order
+		size_t total = 0;
+		for(size_t digit = 0; digit < 256; ++digit)
+		{
+			for(size_t c = 0; c < chunks; ++c)
+			{
+				size_t n = offsets[c * 256 + digit];
+				offsets[c * 256 + digit] = total;
+				total += n;
+			}
+		}
+
+		ForChunks(pPool, chunks, [&](size_t first, size_t last)
+			  {
+				  for(size_t c = first; c < last; ++c)
+				  {
+					  size_t* next = &offsets[c * 256];
+					  size_t end = std::min((c + 1) * RADIX_CHUNK, count);
+					  for(size_t i = c * RADIX_CHUNK; i < end; ++i)
+					  {
+						  size_t dst = next[(keys[i] >> shift) & 0xFF]++;
+						  keysout[dst] = keys[i];
+						  valuesout[dst] = values[i];
+					  }
+				  }
+			  });
+		keys.swap(keysout);
+		values.swap(valuesout);
+	}
+}
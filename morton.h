@@ -0,0 +1,26 @@
+#ifndef MORTON_H_
+#define MORTON_H_
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "vmath.h"
+
+class ThreadPool;
+
+//Interleaves the low 21 bits of x, y and z into a 63 bit Z-order key,
+//x in the lowest bit
+uint64_t MortonEncode(uint32_t x, uint32_t y, uint32_t z);
+
+//Order of the points along the Z-order curve through their bounding box:
+//order[i] is the index of the i-th point. Ties keep the input order.
+void MortonOrder(const vmath::vec3* points, size_t count, std::vector<uint32_t>& order,
+		 ThreadPool* pPool = 0);
+
+//Stable LSD radix sort of keys, carrying values along, one byte per pass.
+//Passes over bytes that every key shares are skipped. Each pass counts
+//and scatters per chunk on the pool, so the result is the same for any
+//thread count.
+void RadixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values,
+	       ThreadPool* pPool = 0);
+
+#endif
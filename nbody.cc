@@ -0,0 +1,414 @@
+#include "nbody.h"
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include "morton.h"
+#include "ssemath.h"
+#include "threadpool.h"
+
+//Bodies per pool task when integrating, and groups per task when summing
+#define NBODY_GRAIN 16384
+#define NBODY_GROUP_GRAIN 16
+//Most bodies sharing one walk of the tree
+#define NBODY_GROUP_SIZE 128
+//Deepest level of the tree split out into subtrees built in parallel
+#define NBODY_MAX_DEFER 6
+//Levels of a 21 bit per axis Morton key
+#define NBODY_LEVELS 21
+
+static void ForRange(ThreadPool* pPool, size_t count, size_t grain,
+		     const std::function<void(size_t, size_t)>& fn)
+{
+	if(pPool)
+	{
+		pPool->ParallelFor(0, count, grain, fn);
+	}
+	else if(count)
+	{
+		fn(0, count);
+	}
+}
+
+//Octant of a key at level, among the cells of level + 1
+static inline unsigned int Octant(uint64_t key, int level)
+{
+	return (key >> (3 * (NBODY_LEVELS - 1 - level))) & 7;
+}
+
+NBody::NBody() :
+	m_extent(1.f),
+	m_theta(0.5f),
+	m_eps(0.01f),
+	m_mem("N-body")
+{
+}
+
+void NBody::Init(const vmath::vec3* positions, const vmath::vec3* velocities, const float* masses,
+		 size_t count, ThreadPool* pPool)
+{
+	m_x.resize(count);
+	m_y.resize(count);
+	m_z.resize(count);
+	m_vx.resize(count);
+	m_vy.resize(count);
+	m_vz.resize(count);
+	m_ax.assign(count, 0.f);
+	m_ay.assign(count, 0.f);
+	m_az.assign(count, 0.f);
+	m_mass.assign(masses, masses + count);
+	for(size_t i = 0; i < count; ++i)
+	{
+		m_x[i] = positions[i][0];
+		m_y[i] = positions[i][1];
+		m_z[i] = positions[i][2];
+		m_vx[i] = velocities[i][0];
+		m_vy[i] = velocities[i][1];
+		m_vz[i] = velocities[i][2];
+	}
+	BuildTree(pPool);
+	ComputeForces(pPool);
+	UpdateMemory();
+}
+
+void NBody::Step(float dt, ThreadPool* pPool)
+{
+	float half = 0.5f * dt;
+	ForRange(pPool, Size(), NBODY_GRAIN, [this, dt, half](size_t first, size_t last)
+	{
+		for(size_t i = first; i < last; ++i)
+		{
+			m_vx[i] += m_ax[i] * half;
+			m_vy[i] += m_ay[i] * half;
+			m_vz[i] += m_az[i] * half;
+			m_x[i] += m_vx[i] * dt;
+			m_y[i] += m_vy[i] * dt;
+			m_z[i] += m_vz[i] * dt;
+		}
+	});
+
+	BuildTree(pPool);
+	ComputeForces(pPool);
+
+	ForRange(pPool, Size(), NBODY_GRAIN, [this, half](size_t first, size_t last)
+	{
+		for(size_t i = first; i < last; ++i)
+		{
+			m_vx[i] += m_ax[i] * half;
+			m_vy[i] += m_ay[i] * half;
+			m_vz[i] += m_az[i] * half;
+		}
+	});
+	UpdateMemory();
+}
+
+void NBody::GetPositions(size_t first, size_t count, Vertex* verts) const
+{
+	for(size_t i = 0; i < count; ++i)
+	{
+		verts[i].vertex[0] = m_x[first + i];
+		verts[i].vertex[1] = m_y[first + i];
+		verts[i].vertex[2] = m_z[first + i];
+	}
+}
+
+void NBody::BuildTree(ThreadPool* pPool)
+{
+	size_t count = Size();
+	m_nodes.clear();
+	m_groups.clear();
+	if(!count)
+	{
+		return;
+	}
+
+	//Cubic root cell around every body, quantised to 21 bits per axis
+	float lo[3] = {m_x[0], m_y[0], m_z[0]}, hi[3] = {m_x[0], m_y[0], m_z[0]};
+	for(size_t i = 1; i < count; ++i)
+	{
+		lo[0] = std::min(lo[0], m_x[i]);
+		lo[1] = std::min(lo[1], m_y[i]);
+		lo[2] = std::min(lo[2], m_z[i]);
+		hi[0] = std::max(hi[0], m_x[i]);
+		hi[1] = std::max(hi[1], m_y[i]);
+		hi[2] = std::max(hi[2], m_z[i]);
+	}
+	m_extent = std::max(std::max(hi[0] - lo[0], hi[1] - lo[1]), std::max(hi[2] - lo[2], 1e-6f)) * 1.0001f;
+	const float maxcell = (1u << NBODY_LEVELS) - 1;
+	float scale = (1u << NBODY_LEVELS) / m_extent;
+
+	m_keys.resize(count);
+	m_order.resize(count);
+	ForRange(pPool, count, NBODY_GRAIN, [&](size_t first, size_t last)
+	{
+		for(size_t i = first; i < last; ++i)
+		{
+			uint32_t x = std::min((m_x[i] - lo[0]) * scale, maxcell);
+			uint32_t y = std::min((m_y[i] - lo[1]) * scale, maxcell);
+			uint32_t z = std::min((m_z[i] - lo[2]) * scale, maxcell);
+			m_keys[i] = MortonEncode(x, y, z);
+			m_order[i] = i;
+		}
+	});
+	RadixSort(m_keys, m_order, pPool);
+
+	m_sx.resize(count);
+	m_sy.resize(count);
+	m_sz.resize(count);
+	m_sm.resize(count);
+	ForRange(pPool, count, NBODY_GRAIN, [this](size_t first, size_t last)
+	{
+		for(size_t i = first; i < last; ++i)
+		{
+			uint32_t id = m_order[i];
+			m_sx[i] = m_x[id];
+			m_sy[i] = m_y[id];
+			m_sz[i] = m_z[id];
+			m_sm[i] = m_mass[id];
+		}
+	});
+
+	//The cells of a level deep enough to keep every thread busy are built
+	//as separate subtrees, then the levels above are joined on top of them
+	int depth = 0;
+	if(pPool && pPool->GetThreadCount() > 1)
+	{
+		while(depth < NBODY_MAX_DEFER && (1u << (3 * depth)) < 8 * pPool->GetThreadCount())
+		{
+			++depth;
+		}
+	}
+	std::vector<std::pair<size_t, size_t>> cells;
+	int shift = 3 * (NBODY_LEVELS - depth);
+	for(size_t first = 0; first < count;)
+	{
+		size_t last = first + 1;
+		while(last < count && (m_keys[last] >> shift) == (m_keys[first] >> shift))
+		{
+			++last;
+		}
+		cells.push_back(std::make_pair(first, last));
+		first = last;
+	}
+	std::vector<std::vector<Node>> subtrees(cells.size());
+	ForRange(pPool, cells.size(), 1, [&](size_t first, size_t last)
+	{
+		for(size_t i = first; i < last; ++i)
+		{
+			BuildNode(subtrees[i], cells[i].first, cells[i].second, depth);
+		}
+	});
+
+	size_t total = ((1u << (3 * depth)) - 1) / 7;
+	for(size_t i = 0; i < subtrees.size(); ++i)
+	{
+		total += subtrees[i].size();
+	}
+	m_nodes.resize(total);
+	std::vector<uint32_t> bases;
+	size_t used = 0;
+	BuildTop(0, count, 0, depth, subtrees, bases, used);
+	m_nodes.resize(used);
+
+	ForRange(pPool, subtrees.size(), 1, [&](size_t first, size_t last)
+	{
+		for(size_t i = first; i < last; ++i)
+		{
+			Node* out = &m_nodes[bases[i]];
+			for(size_t j = 0; j < subtrees[i].size(); ++j)
+			{
+				out[j] = subtrees[i][j];
+				out[j].next += bases[i];
+			}
+		}
+	});
+
+	//Groups are the largest cells holding few enough bodies
+	for(size_t i = 0; i < m_nodes.size();)
+	{
+		if(m_nodes[i].hi - m_nodes[i].lo <= NBODY_GROUP_SIZE)
+		{
+			m_groups.push_back(i);
+			i = m_nodes[i].next;
+		}
+		else
+		{
+			++i;
+		}
+	}
+}
+
+void NBody::BuildNode(std::vector<Node>& nodes, size_t lo, size_t hi, int level) const
+{
+	size_t index = nodes.size();
+	nodes.push_back(Node());
+	double mass = 0.0, mx = 0.0, my = 0.0, mz = 0.0;
+	if(hi - lo <= NBODY_LEAF_SIZE || level == NBODY_LEVELS)
+	{
+		for(size_t i = lo; i < hi; ++i)
+		{
+			mass += m_sm[i];
+			mx += m_sm[i] * m_sx[i];
+			my += m_sm[i] * m_sy[i];
+			mz += m_sm[i] * m_sz[i];
+		}
+	}
+	else
+	{
+		//Keys in the cell share every octant above this level, so each
+		//child is the run of keys with the same octant here
+		for(size_t first = lo; first < hi;)
+		{
+			unsigned int octant = Octant(m_keys[first], level);
+			size_t last = std::upper_bound(m_keys.begin() + first, m_keys.begin() + hi, octant,
+						       [level](unsigned int o, uint64_t key)
+						       {
+							       return o < Octant(key, level);
+						       }) - m_keys.begin();
+			size_t child = nodes.size();
+			BuildNode(nodes, first, last, level + 1);
+			const Node& c = nodes[child];
+			mass += c.mass;
+			mx += (double) c.mass * c.x;
+			my += (double) c.mass * c.y;
+			mz += (double) c.mass * c.z;
+			first = last;
+		}
+	}
+
+	Node& node = nodes[index];
+	double inv = mass > 0.0 ? 1.0 / mass : 0.0;
+	node.x = mx * inv;
+	node.y = my * inv;
+	node.z = mz * inv;
+	node.mass = mass;
+	node.size = ldexpf(m_extent, -level);
+	node.next = nodes.size();
+	node.lo = lo;
+	node.hi = hi;
+}
+
+void NBody::BuildTop(size_t lo, size_t hi, int level, int depth, std::vector<std::vector<Node>>& subtrees,
+		     std::vector<uint32_t>& bases, size_t& count)
+{
+	if(level == depth)
+	{
+		//Subtrees come in key order, as the cells are visited here; the
+		//root is placed now for the parent, the rest copied later
+		size_t i = bases.size();
+		bases.push_back(count);
+		m_nodes[count] = subtrees[i][0];
+		m_nodes[count].next += count;
+		count += subtrees[i].size();
+		return;
+	}
+
+	size_t index = count++;
+	double mass = 0.0, mx = 0.0, my = 0.0, mz = 0.0;
+	for(size_t first = lo; first < hi;)
+	{
+		unsigned int octant = Octant(m_keys[first], level);
+		size_t last = first + 1;
+		while(last < hi && Octant(m_keys[last], level) == octant)
+		{
+			++last;
+		}
+		size_t child = count;
+		BuildTop(first, last, level + 1, depth, subtrees, bases, count);
+		const Node& c = m_nodes[child];
+		mass += c.mass;
+		mx += (double) c.mass * c.x;
+		my += (double) c.mass * c.y;
+		mz += (double) c.mass * c.z;
+		first = last;
+	}
+
+	Node& node = m_nodes[index];
+	double inv = mass > 0.0 ? 1.0 / mass : 0.0;
+	node.x = mx * inv;
+	node.y = my * inv;
+	node.z = mz * inv;
+	node.mass = mass;
+	node.size = ldexpf(m_extent, -level);
+	node.next = count;
+	node.lo = lo;
+	node.hi = hi;
+}
+
+void NBody::ComputeForces(ThreadPool* pPool)
+{
+	//A cell is opened unless it is at least size / theta from the whole
+	//group. Past theta = 1/sqrt(3) an ancestor of the group could pass, so
+	//that is the ceiling.
+	const float open = std::min(m_theta * m_theta, 1.f / 3.f);
+	const float eps2 = m_eps * m_eps;
+	ForRange(pPool, m_groups.size(), NBODY_GROUP_GRAIN, [this, open, eps2](size_t first, size_t last)
+	{
+		std::vector<float> px, py, pz, pm;
+		for(size_t l = first; l < last; ++l)
+		{
+			const Node& group = m_nodes[m_groups[l]];
+			float lo[3] = {m_sx[group.lo], m_sy[group.lo], m_sz[group.lo]};
+			float hi[3] = {lo[0], lo[1], lo[2]};
+			for(size_t i = group.lo + 1; i < group.hi; ++i)
+			{
+				lo[0] = std::min(lo[0], m_sx[i]);
+				lo[1] = std::min(lo[1], m_sy[i]);
+				lo[2] = std::min(lo[2], m_sz[i]);
+				hi[0] = std::max(hi[0], m_sx[i]);
+				hi[1] = std::max(hi[1], m_sy[i]);
+				hi[2] = std::max(hi[2], m_sz[i]);
+			}
+
+			px.clear();
+			py.clear();
+			pz.clear();
+			pm.clear();
+			for(size_t i = 0; i < m_nodes.size();)
+			{
+				const Node& node = m_nodes[i];
+				float dx = std::max(std::max(lo[0] - node.x, node.x - hi[0]), 0.f);
+				float dy = std::max(std::max(lo[1] - node.y, node.y - hi[1]), 0.f);
+				float dz = std::max(std::max(lo[2] - node.z, node.z - hi[2]), 0.f);
+				if(node.size * node.size < open * (dx * dx + dy * dy + dz * dz))
+				{
+					px.push_back(node.x);
+					py.push_back(node.y);
+					pz.push_back(node.z);
+					pm.push_back(node.mass);
+					i = node.next;
+				}
+				else if(node.next == i + 1)
+				{
+					px.insert(px.end(), &m_sx[node.lo], &m_sx[node.hi]);
+					py.insert(py.end(), &m_sy[node.lo], &m_sy[node.hi]);
+					pz.insert(pz.end(), &m_sz[node.lo], &m_sz[node.hi]);
+					pm.insert(pm.end(), &m_sm[node.lo], &m_sm[node.hi]);
+					i = node.next;
+				}
+				else
+				{
+					++i;
+				}
+			}
+
+			for(size_t i = group.lo; i < group.hi; ++i)
+			{
+				float acc[3] = {0.f, 0.f, 0.f};
+				GravityBatch(px.data(), py.data(), pz.data(), pm.data(), px.size(),
+					     m_sx[i], m_sy[i], m_sz[i], eps2, acc);
+				uint32_t id = m_order[i];
+				m_ax[id] = acc[0];
+				m_ay[id] = acc[1];
+				m_az[id] = acc[2];
+			}
+		}
+	});
+}
+
+void NBody::UpdateMemory()
+{
+	m_mem.SetCPU(14 * m_x.capacity() * sizeof(float) +
+		     m_keys.capacity() * sizeof(uint64_t) +
+		     (m_order.capacity() + m_groups.capacity()) * sizeof(uint32_t) +
+		     m_nodes.capacity() * sizeof(Node));
+}
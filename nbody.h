@@ -0,0 +1,89 @@
+#ifndef NBODY_H_
+#define NBODY_H_
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "vmath.h"
+#include "vertex.h"
+#include "memstats.h"
+
+#define NBODY_LEAF_SIZE 16
+
+class ThreadPool;
+
+//Self-gravitating point masses (G = 1) integrated with kick-drift-kick
+//leapfrog, which is symplectic and keeps energy bounded over long runs.
+//Forces come from a Barnes-Hut octree rebuilt every step: bodies are
+//sorted along a Z-order curve, so each cell is a contiguous run and the
+//tree is laid out depth first with a skip link per node for a stackless
+//walk. Bodies walk the tree in small groups, once per group, collecting
+//the cells far enough away to stand in for their contents and the bodies
+//of the leaves that are not, and the list is then summed for each body
+//of the group in SIMD batches.
+class NBody
+{
+public:
+	NBody();
+
+	//Starting state; also evaluates the first forces
+	void Init(const vmath::vec3* positions, const vmath::vec3* velocities, const float* masses,
+		  size_t count, ThreadPool* pPool = 0);
+
+	//Advances every body by dt
+	void Step(float dt, ThreadPool* pPool = 0);
+
+	size_t Size() const
+	{
+		return m_x.size();
+	}
+
+	//A cell stands in for its bodies when its size is below theta times
+	//its distance; lower is more accurate and slower
+	void SetOpeningAngle(float theta)
+	{
+		m_theta = theta;
+	}
+
+	float GetOpeningAngle() const
+	{
+		return m_theta;
+	}
+
+	//Plummer softening length, which keeps close encounters finite
+	void SetSoftening(float eps)
+	{
+		m_eps = eps;
+	}
+
+	//Writes the positions of bodies [first, first + count) into verts
+	void GetPositions(size_t first, size_t count, Vertex* verts) const;
+private:
+	//Centre of mass and total mass of a cell, its edge length, the node
+	//after its subtree and its run of bodies in tree order. A node is a
+	//leaf when next is the node straight after it.
+	struct Node
+	{
+		float x, y, z, mass;
+		float size;
+		uint32_t next, lo, hi;
+	};
+
+	void BuildTree(ThreadPool* pPool);
+	void BuildNode(std::vector<Node>& nodes, size_t lo, size_t hi, int level) const;
+	void BuildTop(size_t lo, size_t hi, int level, int depth, std::vector<std::vector<Node>>& subtrees,
+		      std::vector<uint32_t>& bases, size_t& count);
+	void ComputeForces(ThreadPool* pPool);
+	void UpdateMemory();
+
+	std::vector<float> m_x, m_y, m_z, m_vx, m_vy, m_vz, m_ax, m_ay, m_az, m_mass;
+	std::vector<uint64_t> m_keys;
+	std::vector<uint32_t> m_order; //Body index of each tree position
+	std::vector<float> m_sx, m_sy, m_sz, m_sm; //Bodies in tree order
+	std::vector<Node> m_nodes;
+	std::vector<uint32_t> m_groups; //Cells whose bodies walk the tree together
+	float m_extent; //Edge of the root cell
+	float m_theta, m_eps;
+	MemCounter m_mem;
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "object.h"
 #include "camera.h"
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <string>
@@ -46,10 +47,23 @@ std::string GetShaderErrorMsg(GLuint hShader)
 	return retval;
 }
 
-Object::Object(GLuint drawmode) :
+static std::string SubsystemName(const char* name, const char* part)
+{
+	return std::string(name) + " " + part;
+}
+
+Object::Object(GLuint drawmode, const char* name) :
+	m_ebo_indices(0),
 	m_shader_program(0),
 	m_vbo_reserved(0),
-	m_drawmode(drawmode)
+	m_drawmode(drawmode),
+	m_ebo_reserved(0),
+	m_indexcount(0),
+	m_pVertexSource(0),
+	m_vertmem(SubsystemName(name, "vertices").c_str()),
+	m_shadermem(SubsystemName(name, "shader text").c_str()),
+	m_indexmem(SubsystemName(name, "indices").c_str()),
+	m_attribmem(SubsystemName(name, "attributes").c_str())
 {
 	glGenBuffers(1, &m_vbo_vertices);
 	glGenVertexArrays(1, &m_vao);
@@ -59,6 +73,14 @@ Object::~Object()
 {
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glDeleteBuffers(1, &m_vbo_vertices);
+	if(m_ebo_indices)
+	{
+		glDeleteBuffers(1, &m_ebo_indices);
+	}
+	for(Attribute& attrib : m_attributes)
+	{
+		glDeleteBuffers(1, &attrib.vbo);
+	}
 	glBindVertexArray(0);
 	glDeleteVertexArrays(1, &m_vao);
 
@@ -73,32 +95,83 @@ Object::~Object()
 void Object::AddVertex(const vmath::vec4& v, const vmath::Tvec4<unsigned char>& c)
 {
 	m_data.emplace_back(Vertex(c, v));
+	m_vertmem.SetCPU(m_data.capacity() * sizeof(struct Vertex));
 }
 
-void Object::UpdateBuffer()
+bool Object::ReserveBuffer()
 {
-	glBindBuffer(GL_ARRAY_BUFFER, m_vbo_vertices);
+	//Grows the VBO geometrically so appending a vertex at a time does not
+	//reallocate on every upload. Returns true if the storage was replaced,
+	//in which case its contents are undefined.
 	size_t newsize = m_data.size() * sizeof(struct Vertex);
 	if(newsize <= m_vbo_reserved) [[likely]]
 	{
-		glBufferSubData(GL_ARRAY_BUFFER, 0, m_data.size() * sizeof(struct Vertex), &m_data[0]);
+		return false;
 	}
-	else [[unlikely]]
+	m_vbo_reserved = std::max(newsize, m_vbo_reserved + m_vbo_reserved / 2);
+	glBufferData(GL_ARRAY_BUFFER, m_vbo_reserved, NULL, GL_DYNAMIC_DRAW);
+	m_vertmem.SetGPU(m_vbo_reserved);
+	return true;
+}
+
+void Object::UpdateBuffer()
+{
+	glBindBuffer(GL_ARRAY_BUFFER, m_vbo_vertices);
+	ReserveBuffer();
+	if(!m_data.empty())
 	{
-		m_vbo_reserved = newsize;
-		glBufferData(GL_ARRAY_BUFFER, m_vbo_reserved, &m_data[0], GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, m_data.size() * sizeof(struct Vertex), &m_data[0]);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	m_vertmem.SetCPU(m_data.capacity() * sizeof(struct Vertex));
+}
 
+void Object::UpdateBufferRange(size_t first, size_t count)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, m_vbo_vertices);
+	if(ReserveBuffer())
+	{
+		first = 0;
+		count = m_data.size();
+	}
+	if(first < m_data.size())
+	{
+		count = std::min(count, m_data.size() - first);
+		glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(struct Vertex),
+				count * sizeof(struct Vertex), &m_data[first]);
 	}
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	m_vertmem.SetCPU(m_data.capacity() * sizeof(struct Vertex));
 }
 
 void Object::InitBuffer()
 {
-	glBindVertexArray(m_vao);
-	glBindBuffer(GL_ARRAY_BUFFER, m_vbo_vertices);
+	SetupBuffer(m_data.empty() ? NULL : &m_data[0]);
+}
 
-	m_vbo_reserved = m_data.size() * sizeof(struct Vertex);
-	glBufferData(GL_ARRAY_BUFFER, m_vbo_reserved, &m_data[0], GL_DYNAMIC_DRAW);
+void Object::InitBuffer(const Vertex* verts, size_t count)
+{
+	m_data.assign(verts, verts + count);
+	SetupBuffer(count ? verts : NULL);
+}
+
+void Object::SetupBuffer(const Vertex* upload)
+{
+	glBindVertexArray(m_vao);
+	if(m_pVertexSource)
+	{
+		//The VAO only records the buffer name, so the source growing its
+		//storage later does not break the sharing
+		glBindBuffer(GL_ARRAY_BUFFER, m_pVertexSource->m_vbo_vertices);
+	}
+	else
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, m_vbo_vertices);
+		m_vbo_reserved = m_data.size() * sizeof(struct Vertex);
+		glBufferData(GL_ARRAY_BUFFER, m_vbo_reserved, upload, GL_DYNAMIC_DRAW);
+		m_vertmem.SetGPU(m_vbo_reserved);
+		m_vertmem.SetCPU(m_data.capacity() * sizeof(struct Vertex));
+	}
 
 	glEnableVertexAttribArray(0);
 	glEnableVertexAttribArray(1);
@@ -110,6 +183,101 @@ void Object::InitBuffer()
 	glBindVertexArray(0);
 }
 
+void Object::AddAttribute(GLuint location, int components, const float* data, size_t count)
+{
+	Attribute attrib;
+	attrib.location = location;
+	attrib.components = components;
+	attrib.count = count;
+	glGenBuffers(1, &attrib.vbo);
+
+	glBindVertexArray(m_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, attrib.vbo);
+	glBufferData(GL_ARRAY_BUFFER, count * components * sizeof(float), data, GL_STATIC_DRAW);
+	glEnableVertexAttribArray(location);
+	glVertexAttribPointer(location, components, GL_FLOAT, GL_FALSE, components * sizeof(float), 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+
+	m_attributes.push_back(attrib);
+	size_t bytes = 0;
+	for(const Attribute& a : m_attributes)
+	{
+		bytes += a.count * a.components * sizeof(float);
+	}
+	m_attribmem.SetGPU(bytes);
+}
+
+void Object::UpdateAttribute(GLuint location, const float* data)
+{
+	for(const Attribute& attrib : m_attributes)
+	{
+		if(attrib.location == location)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, attrib.vbo);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, attrib.count * attrib.components * sizeof(float), data);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			return;
+		}
+	}
+}
+
+void Object::SetUniform(const char* name, float value)
+{
+	for(Uniform& uniform : m_uniforms)
+	{
+		if(uniform.name == name)
+		{
+			uniform.value = value;
+			return;
+		}
+	}
+	m_uniforms.push_back(Uniform{name, glGetUniformLocation(m_shader_program, name), value});
+}
+
+bool Object::ReserveIndices(size_t count)
+{
+	//Expects the VAO to be bound, as it owns the element buffer binding
+	if(!m_ebo_indices)
+	{
+		glGenBuffers(1, &m_ebo_indices);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ebo_indices);
+	}
+	size_t newsize = count * sizeof(uint32_t);
+	if(newsize <= m_ebo_reserved) [[likely]]
+	{
+		return false;
+	}
+	m_ebo_reserved = std::max(newsize, m_ebo_reserved + m_ebo_reserved / 2);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_ebo_reserved, NULL, GL_DYNAMIC_DRAW);
+	m_indexmem.SetGPU(m_ebo_reserved);
+	return true;
+}
+
+void Object::SetIndices(const uint32_t* indices, size_t count)
+{
+	UpdateIndexRange(indices, count, 0, count);
+}
+
+void Object::UpdateIndexRange(const uint32_t* indices, size_t count,
+			      size_t first, size_t len)
+{
+	glBindVertexArray(m_vao);
+	if(ReserveIndices(count))
+	{
+		first = 0;
+		len = count;
+	}
+	if(first < count)
+	{
+		len = std::min(len, count - first);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, first * sizeof(uint32_t),
+				len * sizeof(uint32_t), indices + first);
+	}
+	glBindVertexArray(0);
+	m_indexcount = count;
+}
+
 void Object::Draw(const Camera* pCamera)
 {
 	glUseProgram(m_shader_program);
@@ -120,8 +288,19 @@ void Object::Draw(const Camera* pCamera)
 	//glUniformMatrix4fv(m_proj_location, 1, GL_FALSE,
 	//		   pCamera->GetProjectionTransform());
 	glUniformMatrix4fv(m_combined_location, 1, GL_FALSE, combinedmat);
+	for(const Uniform& uniform : m_uniforms)
+	{
+		glUniform1f(uniform.location, uniform.value);
+	}
 	glBindVertexArray(m_vao);
-	glDrawArrays(m_drawmode, 0, m_data.size());
+	if(m_ebo_indices)
+	{
+		glDrawElements(m_drawmode, m_indexcount, GL_UNSIGNED_INT, 0);
+	}
+	else
+	{
+		glDrawArrays(m_drawmode, 0, m_data.size());
+	}
 	glBindVertexArray(0);
 
 	glUseProgram(0);
@@ -131,6 +310,7 @@ bool Object::LoadShaders(const char* vertfn, const char* fragfn)
 {
 	LoadTextFile(vertfn, m_vertshadertext);
 	LoadTextFile(fragfn, m_fragshadertext);
+	m_shadermem.SetCPU(m_vertshadertext.capacity() + m_fragshadertext.capacity());
 
 	GLuint vs = glCreateShader(GL_VERTEX_SHADER);
 	GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
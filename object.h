@@ -1,26 +1,59 @@
 #ifndef OBJECT_H_
 #define OBJECT_H_
 #include <vector>
+#include <string>
+#include <cstdint>
 
 #include <GL/glew.h> // include GLEW and new version of GL on Windows
 #include <GLFW/glfw3.h> // GLFW helper library
 #include "vmath.h"
 #include "object.h"
 #include "vertex.h"
+#include "memstats.h"
 
 class Camera;
 
 class Object
 {
 public:
-	Object(GLuint drawmode = GL_LINES);
+	//name prefixes the memory subsystems the object reports to
+	Object(GLuint drawmode = GL_LINES, const char* name = "Object");
 	~Object();
 
 	void AddVertex(const vmath::vec4& v, const vmath::Tvec4<unsigned char>& c);
 	void UpdateBuffer();
+	//Uploads only vertices [first, first + count)
+	void UpdateBufferRange(size_t first, size_t count);
 	void InitBuffer();
+	//Takes count vertices and uploads them straight from verts, which may
+	//be a file mapping. The object still keeps its own copy, which later
+	//updates such as spawning, recolouring and N-body steps write into.
+	void InitBuffer(const Vertex* verts, size_t count);
+
+	//Draws from source's vertex buffer instead of this object's own. Must
+	//be called before InitBuffer, and source must outlive this object.
+	void ShareVertices(const Object& source)
+	{
+		m_pVertexSource = &source;
+	}
+
+	//Switches to indexed drawing of count indices. UpdateIndexRange takes
+	//the whole index array but uploads only [first, first + len).
+	void SetIndices(const uint32_t* indices, size_t count);
+	void UpdateIndexRange(const uint32_t* indices, size_t count,
+			      size_t first, size_t len);
 	bool LoadShaders(const char* vertfn, const char* fragfn);
 
+	//Extra per-vertex attribute of components floats per vertex, read by
+	//the shader at location, in its own buffer. Call after InitBuffer;
+	//UpdateAttribute replaces the data of one added earlier.
+	void AddAttribute(GLuint location, int components, const float* data, size_t count);
+	void UpdateAttribute(GLuint location, const float* data);
+
+	//Float uniform of the shader, kept and set again on every Draw. Call
+	//after LoadShaders.
+	void SetUniform(const char* name, float value);
+
 	void SetObjectTransform(const vmath::mat4& transform)
 	{
 		//Scale, position, rotation of object
@@ -33,6 +66,7 @@ public:
 	void ClearVerts()
 	{
 		m_data.clear();
+		m_vertmem.SetCPU(m_data.capacity() * sizeof(struct Vertex));
 	}
 
 	std::vector<Vertex>& GetVerts()
@@ -47,11 +81,29 @@ public:
 		return m_shader_program;
 	}
 private:
+	struct Attribute
+	{
+		GLuint location, vbo;
+		int components;
+		size_t count;
+	};
+
+	struct Uniform
+	{
+		std::string name;
+		GLint location;
+		float value;
+	};
+
+	bool ReserveBuffer();
+	void SetupBuffer(const Vertex* upload);
+	bool ReserveIndices(size_t count);
 
 	std::vector<char> m_vertshadertext, m_fragshadertext;
 	std::vector<Vertex> m_data;
 	vmath::mat4 m_modeltransform;
 	GLuint m_vbo_vertices;
+	GLuint m_ebo_indices; //0 until the object is drawn indexed
 	GLuint m_vao;
 	GLuint m_shader_program;
 	GLuint m_model_location, m_proj_location, m_view_location;
@@ -59,6 +111,12 @@ private:
 	GLuint m_drawmode;
 
 	size_t m_vbo_reserved;
+	size_t m_ebo_reserved, m_indexcount;
+	const Object* m_pVertexSource;
+	std::vector<Attribute> m_attributes;
+	std::vector<Uniform> m_uniforms;
+
+	MemCounter m_vertmem, m_shadermem, m_indexmem, m_attribmem;
 };
 
 
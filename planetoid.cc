@@ -0,0 +1,169 @@
+#include "planetoid.h"
+#include <algorithm>
+#include <cmath>
+#include "ssemath.h"
+#include "threadpool.h"
+#include "snapshot.h"
+
+//Planetoids handed to each pool task, and evaluated together within one
+#define PLANETOID_GRAIN 16384
+#define PLANETOID_BLOCK 512
+
+PlanetoidStore::PlanetoidStore() :
+	m_mem("Planetoids")
+{
+}
+
+void PlanetoidStore::Add(const vmath::vec3& centre, float a, float b, float t, float anglerate,
+			 const vmath::Tquaternion<float>& rot)
+{
+	vmath::vec4 u(a, 0.f, 0.f, 0.f), v(0.f, 0.f, b, 0.f);
+	u = rot * u * rot.inverse();
+	v = rot * v * rot.inverse();
+	if(b > a)
+	{
+		std::swap(u, v);
+		std::swap(a, b);
+	}
+
+	m_fx.push_back(centre[0]);
+	m_fy.push_back(centre[1]);
+	m_fz.push_back(centre[2]);
+	m_px.push_back(u[0]);
+	m_py.push_back(u[1]);
+	m_pz.push_back(u[2]);
+	m_qx.push_back(v[0]);
+	m_qy.push_back(v[1]);
+	m_qz.push_back(v[2]);
+	m_e.push_back(sqrt(1.f - (b * b) / (a * a)));
+	m_mean.push_back(t);
+	m_rate.push_back(anglerate);
+	m_mem.SetCPU(PLANETOID_COLUMNS * m_e.capacity() * sizeof(float));
+}
+
+std::vector<float> PlanetoidStore::* const PlanetoidStore::s_columns[PLANETOID_COLUMNS] = {
+	&PlanetoidStore::m_fx, &PlanetoidStore::m_fy, &PlanetoidStore::m_fz,
+	&PlanetoidStore::m_px, &PlanetoidStore::m_py, &PlanetoidStore::m_pz,
+	&PlanetoidStore::m_qx, &PlanetoidStore::m_qy, &PlanetoidStore::m_qz,
+	&PlanetoidStore::m_e, &PlanetoidStore::m_mean, &PlanetoidStore::m_rate
+};
+
+void PlanetoidStore::Append(const PlanetoidStore& other)
+{
+	for(int i = 0; i < PLANETOID_COLUMNS; ++i)
+	{
+		const std::vector<float>& theirs = other.*s_columns[i];
+		(this->*s_columns[i]).insert((this->*s_columns[i]).end(), theirs.begin(), theirs.end());
+	}
+	m_mem.SetCPU(PLANETOID_COLUMNS * m_e.capacity() * sizeof(float));
+}
+
+void PlanetoidStore::AddColumns(SnapshotWriter& writer) const
+{
+	for(int i = 0; i < PLANETOID_COLUMNS; ++i)
+	{
+		const std::vector<float>& column = this->*s_columns[i];
+		writer.AddColumn(SNAPSHOT_PLANETOID_ORBITS + i, column.data(), sizeof(float), column.size());
+	}
+}
+
+bool PlanetoidStore::ReadColumns(const SnapshotReader& reader)
+{
+	const float* columns[PLANETOID_COLUMNS];
+	size_t count = 0;
+	for(int i = 0; i < PLANETOID_COLUMNS; ++i)
+	{
+		size_t n = 0;
+		columns[i] = reader.GetColumn<float>(SNAPSHOT_PLANETOID_ORBITS + i, &n);
+		if(!columns[i] || (i && n != count))
+		{
+			return false;
+		}
+		count = n;
+	}
+	for(int i = 0; i < PLANETOID_COLUMNS; ++i)
+	{
+		(this->*s_columns[i]).assign(columns[i], columns[i] + count);
+	}
+	m_mem.SetCPU(PLANETOID_COLUMNS * m_e.capacity() * sizeof(float));
+	return true;
+}
+
+vmath::vec3 PlanetoidStore::GetOrbitCentre(size_t i) const
+{
+	return vmath::vec3(m_fx[i] - m_e[i] * m_px[i],
+			   m_fy[i] - m_e[i] * m_py[i],
+			   m_fz[i] - m_e[i] * m_pz[i]);
+}
+
+void PlanetoidStore::GetOrbitAttributes(double epoch, std::vector<float>& focus,
+					std::vector<float>& major, std::vector<float>& minor) const
+{
+	focus.resize(4 * Size());
+	major.resize(4 * Size());
+	minor.resize(4 * Size());
+	for(size_t i = 0; i < Size(); ++i)
+	{
+		double turns = (m_mean[i] + m_rate[i] * epoch) * (0.5 / M_PI);
+		float* f = &focus[4 * i];
+		float* p = &major[4 * i];
+		float* q = &minor[4 * i];
+		f[0] = m_fx[i];
+		f[1] = m_fy[i];
+		f[2] = m_fz[i];
+		f[3] = m_e[i];
+		p[0] = m_px[i];
+		p[1] = m_py[i];
+		p[2] = m_pz[i];
+		p[3] = m_rate[i];
+		q[0] = m_qx[i];
+		q[1] = m_qy[i];
+		q[2] = m_qz[i];
+		q[3] = (turns - nearbyint(turns)) * (2.0 * M_PI);
+	}
+}
+
+void PlanetoidStore::Evaluate(double time, Vertex* verts, ThreadPool* pPool)
+{
+	auto evaluate = [this, time, verts](size_t first, size_t last)
+	{
+		float mean[PLANETOID_BLOCK], s[PLANETOID_BLOCK], c[PLANETOID_BLOCK];
+		for(size_t lo = first; lo < last; lo += PLANETOID_BLOCK)
+		{
+			size_t n = std::min(last - lo, (size_t) PLANETOID_BLOCK);
+			//Mean anomalies in double, wrapped to [-pi, pi] before they
+			//are narrowed, so late times lose no precision
+			const float *mean0 = &m_mean[lo], *rate = &m_rate[lo];
+			for(size_t i = 0; i < n; ++i)
+			{
+				double turns = (mean0[i] + rate[i] * time) * (0.5 / M_PI);
+				mean[i] = (turns - nearbyint(turns)) * (2.0 * M_PI);
+			}
+			KeplerBatch(mean, &m_e[lo], n, s, c);
+
+			//Measured from the focus, the point at eccentric anomaly E is
+			//p (cos E - e) + q sin E
+			const float *fx = &m_fx[lo], *fy = &m_fy[lo], *fz = &m_fz[lo];
+			const float *px = &m_px[lo], *py = &m_py[lo], *pz = &m_pz[lo];
+			const float *qx = &m_qx[lo], *qy = &m_qy[lo], *qz = &m_qz[lo];
+			const float* e = &m_e[lo];
+			Vertex* out = verts + lo;
+			for(size_t i = 0; i < n; ++i)
+			{
+				float along = c[i] - e[i];
+				out[i].vertex[0] = fx[i] + px[i] * along + qx[i] * s[i];
+				out[i].vertex[1] = fy[i] + py[i] * along + qy[i] * s[i];
+				out[i].vertex[2] = fz[i] + pz[i] * along + qz[i] * s[i];
+			}
+		}
+	};
+
+	if(pPool)
+	{
+		pPool->ParallelFor(0, Size(), PLANETOID_GRAIN, evaluate);
+	}
+	else if(Size())
+	{
+		evaluate(0, Size());
+	}
+}
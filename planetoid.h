@@ -0,0 +1,75 @@
+#ifndef PLANETOID_H_
+#define PLANETOID_H_
+#include <vector>
+#include <cstddef>
+#include "vmath.h"
+#include "vertex.h"
+#include "memstats.h"
+
+class ThreadPool;
+class SnapshotWriter;
+class SnapshotReader;
+
+//Arrays per orbit, and so snapshot columns
+#define PLANETOID_COLUMNS 12
+
+//Planetoids on Kepler orbits around their stars, stored as one array per
+//field so evaluation streams only what it needs. An orbit is kept as its
+//focus, its semi-major and semi-minor axes already rotated into place,
+//its eccentricity, and its mean anomaly at time zero and rate. Positions
+//are evaluated in closed form at an absolute time, so jumping anywhere in
+//time costs the same as the next frame and nothing accumulates error.
+class PlanetoidStore
+{
+public:
+	PlanetoidStore();
+
+	//Orbit with semi-axes a along x and b along z, turned by rot, with the
+	//star at centre as its focus. The mean anomaly starts at t and advances
+	//anglerate radians per second.
+	void Add(const vmath::vec3& centre, float a, float b, float t, float anglerate,
+		 const vmath::Tquaternion<float>& rot);
+
+	//Adds every orbit of other after these
+	void Append(const PlanetoidStore& other);
+
+	size_t Size() const
+	{
+		return m_e.size();
+	}
+
+	//Centre of the ellipse traced by orbit i, offset from its star
+	vmath::vec3 GetOrbitCentre(size_t i) const;
+
+	//The star orbit i goes round, at its focus
+	vmath::vec3 GetFocus(size_t i) const
+	{
+		return vmath::vec3(m_fx[i], m_fy[i], m_fz[i]);
+	}
+
+	//The orbits as three vec4 attributes per planetoid for evaluation in a
+	//shader: focus and eccentricity, semi-major axis and mean motion, and
+	//semi-minor axis and mean anomaly at epoch seconds
+	void GetOrbitAttributes(double epoch, std::vector<float>& focus, std::vector<float>& major,
+				std::vector<float>& minor) const;
+
+	//Writes every position at time seconds into verts, which holds one
+	//vertex per planetoid in the order added
+	void Evaluate(double time, Vertex* verts, ThreadPool* pPool = 0);
+
+	//Each array as its own snapshot column, and back. Reading replaces
+	//every orbit and fails when a column is missing or they disagree in
+	//length.
+	void AddColumns(SnapshotWriter& writer) const;
+	bool ReadColumns(const SnapshotReader& reader);
+private:
+	//Every array, in snapshot column order
+	static std::vector<float> PlanetoidStore::* const s_columns[PLANETOID_COLUMNS];
+
+	std::vector<float> m_fx, m_fy, m_fz;
+	std::vector<float> m_px, m_py, m_pz, m_qx, m_qy, m_qz;
+	std::vector<float> m_e, m_mean, m_rate;
+	MemCounter m_mem;
+};
+
+#endif
@@ -2,6 +2,10 @@
 
 layout(location = 0) in vec4 vp;
 layout(location = 1) in vec4 incol;
+//Orbit elements, for when the positions are evaluated here instead
+layout(location = 2) in vec4 focus; //Star, eccentricity
+layout(location = 3) in vec4 major; //Semi-major axis, mean motion
+layout(location = 4) in vec4 minor; //Semi-minor axis, mean anomaly at the epoch
 
 uniform mat4x4 projviewmodelMat;
 uniform mat4x4 projMat;
@@ -9,16 +13,36 @@ uniform mat4x4 viewMat;
 
 uniform mat4x4 modelMat;
 uniform mat4x4 scaleMat;
+
+uniform float gpuOrbits; //Above 0.5 to ignore vp and evaluate the orbit
+uniform float orbitTime; //Seconds since the epoch
 out vec4 color;
 
+const float PI = 3.14159265;
+
 float InvSquare(vec3 v)
 {
 	return 1.0 / max(pow(v.x, 2.0) + pow(v.y, 2.0) + pow(v.z, 2.0), 1.0);
 }
 
+vec4 OrbitPosition()
+{
+	float e = focus.w;
+	float M = minor.w + major.w * orbitTime;
+	M -= 2.0 * PI * floor((M + PI) / (2.0 * PI));
+
+	//Newton steps on Kepler's equation, as on the CPU
+	float E = M + (M < 0.0 ? -0.85 : 0.85) * e;
+	for(int i = 0; i < 4; ++i)
+	{
+		E -= (E - e * sin(E) - M) / (1.0 - e * cos(E));
+	}
+	return vec4(focus.xyz + major.xyz * (cos(E) - e) + minor.xyz * sin(E), 1.0);
+}
+
 void main()
 {
-	gl_Position =  projviewmodelMat * vp;
+	gl_Position =  projviewmodelMat * (gpuOrbits > 0.5 ? OrbitPosition() : vp);
 	float str = InvSquare(vec3(gl_Position.x, gl_Position.y, gl_Position.z)) + 0.4;
 	gl_PointSize = 1.0 + (str * 3.0);
 	color = vec4((incol[0]/255.0),
@@ -0,0 +1,377 @@
+#include "poisson.h"
+#include "randgen.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <memory>
+
+#define POISSON_ATTEMPTS 30
+#define POISSON_TILE_CELLS 16
+#define POISSON_EMPTY 0xFFFFFFFFu
+
+//Saturated 3D Bridson sampling settles at roughly this many points per r^3
+#define POISSON_DENSITY 0.6f
+
+struct PoissonOffset
+{
+	int dx, dy, dz, order;
+};
+
+struct PoissonTile
+{
+	int lo[3], hi[3]; //Cell range [lo, hi)
+	std::vector<vmath::vec3> points;
+};
+
+class PoissonGrid
+{
+public:
+	PoissonGrid(float radius, const vmath::vec3& lo, const vmath::vec3& hi, int tilecells) :
+		m_lo(lo), m_hi(hi)
+	{
+		m_radius = radius;
+		m_cell = radius / sqrtf(3.f);
+		for(int d = 0; d < 3; ++d)
+		{
+			m_dims[d] = std::max(1, (int) ceilf((hi[d] - lo[d]) / m_cell));
+		}
+		for(int d = 0; d < 3; ++d)
+		{
+			m_tiledims[d] = (m_dims[d] + tilecells - 1) / tilecells;
+		}
+		m_tilecells = tilecells;
+		m_cells.assign((size_t) m_dims[0] * m_dims[1] * m_dims[2], POISSON_EMPTY);
+
+		//A cell is r/sqrt(3) wide, so conflicts lie at most two cells away.
+		//Nearer cells come first since they are likeliest to reject.
+		for(int dz = -2; dz <= 2; ++dz)
+		{
+			for(int dy = -2; dy <= 2; ++dy)
+			{
+				for(int dx = -2; dx <= 2; ++dx)
+				{
+					int gap = std::max(abs(dx) - 1, 0) * std::max(abs(dx) - 1, 0) +
+						std::max(abs(dy) - 1, 0) * std::max(abs(dy) - 1, 0) +
+						std::max(abs(dz) - 1, 0) * std::max(abs(dz) - 1, 0);
+					if(gap < 3)
+					{
+						m_offsets.push_back(PoissonOffset{dx, dy, dz,
+									dx * dx + dy * dy + dz * dz});
+					}
+				}
+			}
+		}
+		std::stable_sort(m_offsets.begin(), m_offsets.end(),
+				 [](const PoissonOffset& a, const PoissonOffset& b)
+				 {
+					 return a.order < b.order;
+				 });
+
+		m_tiles.resize((size_t) m_tiledims[0] * m_tiledims[1] * m_tiledims[2]);
+		for(int tz = 0; tz < m_tiledims[2]; ++tz)
+		{
+			for(int ty = 0; ty < m_tiledims[1]; ++ty)
+			{
+				for(int tx = 0; tx < m_tiledims[0]; ++tx)
+				{
+					PoissonTile& tile = m_tiles[TileIndex(tx, ty, tz)];
+					int t[3] = {tx, ty, tz};
+					for(int d = 0; d < 3; ++d)
+					{
+						tile.lo[d] = t[d] * tilecells;
+						tile.hi[d] = std::min(m_dims[d], tile.lo[d] + tilecells);
+					}
+				}
+			}
+		}
+	}
+
+	size_t TileIndex(int tx, int ty, int tz) const
+	{
+		return ((size_t) tz * m_tiledims[1] + ty) * m_tiledims[0] + tx;
+	}
+
+	void CellOf(const vmath::vec3& p, int* c) const
+	{
+		for(int d = 0; d < 3; ++d)
+		{
+			c[d] = std::min(m_dims[d] - 1, (int) ((p[d] - m_lo[d]) / m_cell));
+		}
+	}
+
+	size_t CellIndex(const int* c) const
+	{
+		return ((size_t) c[2] * m_dims[1] + c[1]) * m_dims[0] + c[0];
+	}
+
+	const vmath::vec3& PointAt(const int* c) const
+	{
+		uint32_t slot = m_cells[CellIndex(c)];
+		const PoissonTile& tile = m_tiles[TileIndex(c[0] / m_tilecells,
+							    c[1] / m_tilecells,
+							    c[2] / m_tilecells)];
+		return tile.points[slot];
+	}
+
+	bool IsFree(const vmath::vec3& p) const
+	{
+		int c[3];
+		CellOf(p, c);
+		float r2 = m_radius * m_radius;
+		for(const PoissonOffset& off : m_offsets)
+		{
+			int n[3] = {c[0] + off.dx, c[1] + off.dy, c[2] + off.dz};
+			if(n[0] < 0 || n[1] < 0 || n[2] < 0 ||
+			   n[0] >= m_dims[0] || n[1] >= m_dims[1] || n[2] >= m_dims[2] ||
+			   m_cells[CellIndex(n)] == POISSON_EMPTY)
+			{
+				continue;
+			}
+			vmath::vec3 delta = PointAt(n) - p;
+			if(vmath::dot(delta, delta) < r2)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void FillTile(size_t tileidx, unsigned long long seed);
+
+	float m_radius, m_cell;
+	vmath::vec3 m_lo, m_hi;
+	int m_dims[3], m_tiledims[3], m_tilecells;
+	std::vector<uint32_t> m_cells;
+	std::vector<PoissonTile> m_tiles;
+	std::vector<PoissonOffset> m_offsets;
+};
+
+static unsigned long long MixSeed(unsigned long long seed, unsigned long long n)
+{
+	//splitmix64 finaliser
+	unsigned long long z = seed + (n + 1) * 0x9E3779B97F4A7C15ull;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+void PoissonGrid::FillTile(size_t tileidx, unsigned long long seed)
+{
+	PoissonTile& tile = m_tiles[tileidx];
+	RandGen rng(MixSeed(seed, tileidx));
+
+	vmath::vec3 tilelo, tilehi;
+	for(int d = 0; d < 3; ++d)
+	{
+		tilelo[d] = m_lo[d] + tile.lo[d] * m_cell;
+		tilehi[d] = std::min(m_hi[d], m_lo[d] + tile.hi[d] * m_cell);
+	}
+
+	auto insert = [this, &tile](const vmath::vec3& p)
+	{
+		int c[3];
+		CellOf(p, c);
+		m_cells[CellIndex(c)] = tile.points.size();
+		tile.points.push_back(p);
+	};
+
+	//Ownership is decided on cells so that rounding cannot put a sample
+	//into a neighbouring tile's cell
+	auto inside = [this, &tile](const vmath::vec3& p)
+	{
+		int c[3];
+		CellOf(p, c);
+		for(int d = 0; d < 3; ++d)
+		{
+			if(p[d] < m_lo[d] || p[d] > m_hi[d] ||
+			   c[d] < tile.lo[d] || c[d] >= tile.hi[d])
+			{
+				return false;
+			}
+		}
+		return true;
+	};
+
+	//Samples already placed by neighbouring tiles seed growth across the
+	//shared border; a dart thrown into the tile covers isolated tiles
+	std::vector<vmath::vec3> active;
+	int c[3];
+	for(c[2] = std::max(0, tile.lo[2] - 2); c[2] < std::min(m_dims[2], tile.hi[2] + 2); ++c[2])
+	{
+		for(c[1] = std::max(0, tile.lo[1] - 2); c[1] < std::min(m_dims[1], tile.hi[1] + 2); ++c[1])
+		{
+			for(c[0] = std::max(0, tile.lo[0] - 2); c[0] < std::min(m_dims[0], tile.hi[0] + 2); ++c[0])
+			{
+				bool bInTile = c[0] >= tile.lo[0] && c[0] < tile.hi[0] &&
+					c[1] >= tile.lo[1] && c[1] < tile.hi[1] &&
+					c[2] >= tile.lo[2] && c[2] < tile.hi[2];
+				if(!bInTile && m_cells[CellIndex(c)] != POISSON_EMPTY)
+				{
+					active.push_back(PointAt(c));
+				}
+			}
+		}
+	}
+
+	for(int attempt = 0; attempt < POISSON_ATTEMPTS; ++attempt)
+	{
+		vmath::vec3 p;
+		for(int d = 0; d < 3; ++d)
+		{
+			p[d] = tilelo[d] + rng.RandFloat() * (tilehi[d] - tilelo[d]);
+		}
+		if(inside(p) && IsFree(p))
+		{
+			insert(p);
+			active.push_back(p);
+			break;
+		}
+	}
+
+	while(!active.empty())
+	{
+		size_t pick = rng.PRNG64() % active.size();
+		vmath::vec3 origin = active[pick];
+		bool bPlaced = false;
+		for(int attempt = 0; attempt < POISSON_ATTEMPTS; ++attempt)
+		{
+			//Uniform direction, radius in [r, 2r)
+			float cz = 2.f * rng.RandFloat() - 1.f;
+			float phi = 2.f * (float) M_PI * rng.RandFloat();
+			float sz = sqrtf(1.f - cz * cz);
+			float dist = m_radius * (1.f + rng.RandFloat());
+			vmath::vec3 p(origin[0] + dist * sz * cosf(phi),
+				      origin[1] + dist * sz * sinf(phi),
+				      origin[2] + dist * cz);
+			if(inside(p) && IsFree(p))
+			{
+				insert(p);
+				active.push_back(p);
+				bPlaced = true;
+				break;
+			}
+		}
+
+		if(!bPlaced)
+		{
+			active[pick] = active.back();
+			active.pop_back();
+		}
+	}
+}
+
+static size_t FillGrid(PoissonGrid& grid, unsigned long long seed, ThreadPool* pPool)
+{
+	//Tiles sharing a parity on every axis are at least a tile apart, which
+	//is more than the two-cell reach of a conflict check
+	for(int phase = 0; phase < 8; ++phase)
+	{
+		std::vector<size_t> batch;
+		for(int tz = phase >> 2 & 1; tz < grid.m_tiledims[2]; tz += 2)
+		{
+			for(int ty = phase >> 1 & 1; ty < grid.m_tiledims[1]; ty += 2)
+			{
+				for(int tx = phase & 1; tx < grid.m_tiledims[0]; tx += 2)
+				{
+					batch.push_back(grid.TileIndex(tx, ty, tz));
+				}
+			}
+		}
+
+		auto fill = [&grid, &batch, seed](size_t first, size_t last)
+		{
+			for(size_t i = first; i < last; ++i)
+			{
+				grid.FillTile(batch[i], seed);
+			}
+		};
+		if(pPool)
+		{
+			pPool->ParallelFor(0, batch.size(), 1, fill);
+		}
+		else
+		{
+			fill(0, batch.size());
+		}
+	}
+
+	size_t total = 0;
+	for(const PoissonTile& tile : grid.m_tiles)
+	{
+		total += tile.points.size();
+	}
+	return total;
+}
+
+size_t PoissonDiskSample(std::vector<vmath::vec3>& out, size_t target, float mindist,
+			 const vmath::vec3& lo, const vmath::vec3& hi,
+			 unsigned long long seed, ThreadPool* pPool)
+{
+	out.clear();
+	if(!target)
+	{
+		return 0;
+	}
+
+	vmath::vec3 extent = hi - lo;
+	float volume = extent[0] * extent[1] * extent[2];
+	float radius = std::max(mindist, cbrtf(POISSON_DENSITY * volume / (1.25f * target)));
+
+	//Tiles are used even serially; they keep the active front small and
+	//cache resident, and make the output identical with or without a pool
+	std::unique_ptr<PoissonGrid> pGrid(new PoissonGrid(radius, lo, hi, POISSON_TILE_CELLS));
+	size_t total = FillGrid(*pGrid, seed, pPool);
+	while(total < target && radius > mindist)
+	{
+		//The density estimate was optimistic; tighten towards mindist
+		radius = std::max(mindist, radius * 0.9f);
+		pGrid.reset(new PoissonGrid(radius, lo, hi, POISSON_TILE_CELLS));
+		total = FillGrid(*pGrid, seed, pPool);
+	}
+	const PoissonGrid& grid = *pGrid;
+
+	out.reserve(std::min(total, target));
+
+	if(total <= target)
+	{
+		for(const PoissonTile& tile : grid.m_tiles)
+		{
+			out.insert(out.end(), tile.points.begin(), tile.points.end());
+		}
+		if(total < target)
+		{
+			fprintf(stderr, "PoissonDiskSample: only %zu of %zu points fit at spacing %f\n",
+				total, target, mindist);
+		}
+		return total;
+	}
+
+	//Any subset keeps the spacing; pick target of them uniformly and keep
+	//them in grid order
+	std::vector<uint32_t> pick(total);
+	for(size_t i = 0; i < total; ++i)
+	{
+		pick[i] = i;
+	}
+	RandGen rng(MixSeed(seed, grid.m_tiles.size()));
+	for(size_t i = 0; i < target; ++i)
+	{
+		size_t j = i + rng.PRNG64() % (total - i);
+		std::swap(pick[i], pick[j]);
+	}
+	std::sort(pick.begin(), pick.begin() + target);
+
+	size_t tileidx = 0, tilebase = 0;
+	for(size_t i = 0; i < target; ++i)
+	{
+		while(pick[i] >= tilebase + grid.m_tiles[tileidx].points.size())
+		{
+			tilebase += grid.m_tiles[tileidx].points.size();
+			++tileidx;
+		}
+		out.push_back(grid.m_tiles[tileidx].points[pick[i] - tilebase]);
+	}
+	return target;
+}
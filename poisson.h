@@ -0,0 +1,21 @@
+#ifndef POISSON_H_
+#define POISSON_H_
+#include <vector>
+#include "vmath.h"
+
+class ThreadPool;
+
+//Bridson-style Poisson-disk sampling inside the box [lo, hi] backed by a
+//uniform grid of cells small enough to hold at most one sample each.
+//Returns exactly target points no closer than mindist to each other, or
+//fewer (with a warning) when the box cannot hold that many. The spacing is
+//widened when target is far below what the box could hold, so the cost
+//stays linear in target rather than in the volume.
+//The box is cut into tiles that are filled in eight phases; tiles within a
+//phase are far enough apart to run concurrently on the pool. The output
+//depends only on seed, never on the thread count.
+size_t PoissonDiskSample(std::vector<vmath::vec3>& out, size_t target, float mindist,
+			 const vmath::vec3& lo, const vmath::vec3& hi,
+			 unsigned long long seed, ThreadPool* pPool = 0);
+
+#endif
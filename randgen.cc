@@ -0,0 +1,208 @@
+#include "randgen.h"
+#include <cstring>
+#include <immintrin.h>
+
+void RandGen::Seed(unsigned long long seed)
+{
+	m_seed = seed;
+	m_wyhash64 = seed;
+
+	//splitmix64 spreads the seed over every lane; it never gives a lane
+	//the all-zero state xoshiro cannot leave
+	unsigned long long z = seed;
+	for(int i = 0; i < RANDGEN_LANES; ++i)
+	{
+		for(int w = 0; w < 4; w += 2)
+		{
+			z += 0x9E3779B97F4A7C15ull;
+			unsigned long long m = z;
+			m = (m ^ (m >> 30)) * 0xBF58476D1CE4E5B9ull;
+			m = (m ^ (m >> 27)) * 0x94D049BB133111EBull;
+			m ^= m >> 31;
+			m_lanes[w][i] = m;
+			m_lanes[w + 1][i] = m >> 32;
+		}
+	}
+}
+
+#if defined(__AVX2__)
+static inline __m256i Rotl(__m256i x, int k)
+{
+	return _mm256_or_si256(_mm256_slli_epi32(x, k), _mm256_srli_epi32(x, 32 - k));
+}
+
+void RandGen::Step(uint32_t* out)
+{
+	__m256i s0 = _mm256_load_si256((const __m256i*) m_lanes[0]);
+	__m256i s1 = _mm256_load_si256((const __m256i*) m_lanes[1]);
+	__m256i s2 = _mm256_load_si256((const __m256i*) m_lanes[2]);
+	__m256i s3 = _mm256_load_si256((const __m256i*) m_lanes[3]);
+	__m256i result = _mm256_add_epi32(Rotl(_mm256_add_epi32(s0, s3), 7), s0);
+	__m256i t = _mm256_slli_epi32(s1, 9);
+	s2 = _mm256_xor_si256(s2, s0);
+	s3 = _mm256_xor_si256(s3, s1);
+	s1 = _mm256_xor_si256(s1, s2);
+	s0 = _mm256_xor_si256(s0, s3);
+	s2 = _mm256_xor_si256(s2, t);
+	s3 = Rotl(s3, 11);
+	_mm256_store_si256((__m256i*) m_lanes[0], s0);
+	_mm256_store_si256((__m256i*) m_lanes[1], s1);
+	_mm256_store_si256((__m256i*) m_lanes[2], s2);
+	_mm256_store_si256((__m256i*) m_lanes[3], s3);
+	_mm256_storeu_si256((__m256i*) out, result);
+}
+
+void RandGen::FillFloats(float* out, size_t count, float lo, float hi)
+{
+	//Random bits under the exponent of 1.0 make a float in [1, 2), and
+	//taking the 1 off is exact
+	const __m256i exponent = _mm256_set1_epi32(0x3F800000);
+	const __m256 one = _mm256_set1_ps(1.f), base = _mm256_set1_ps(lo), scale = _mm256_set1_ps(hi - lo);
+	alignas(32) uint32_t bits[RANDGEN_LANES];
+	for(size_t i = 0; i < count; i += RANDGEN_LANES)
+	{
+		Step(bits);
+		__m256i r = _mm256_or_si256(_mm256_srli_epi32(_mm256_load_si256((const __m256i*) bits), 9), exponent);
+		__m256 f = _mm256_add_ps(base, _mm256_mul_ps(_mm256_sub_ps(_mm256_castsi256_ps(r), one), scale));
+		if(count - i >= RANDGEN_LANES)
+		{
+			_mm256_storeu_ps(out + i, f);
+		}
+		else
+		{
+			alignas(32) float tail[RANDGEN_LANES];
+			_mm256_store_ps(tail, f);
+			memcpy(out + i, tail, (count - i) * sizeof(float));
+		}
+	}
+}
+
+void RandGen::FillDoubles(double* out, size_t count, double lo, double hi)
+{
+	//Pairs of lanes make the 64 bit words
+	const __m256i exponent = _mm256_set1_epi64x(0x3FF0000000000000ll);
+	const __m256d one = _mm256_set1_pd(1.0), base = _mm256_set1_pd(lo), scale = _mm256_set1_pd(hi - lo);
+	alignas(32) uint32_t bits[RANDGEN_LANES];
+	for(size_t i = 0; i < count; i += RANDGEN_LANES / 2)
+	{
+		Step(bits);
+		__m256i r = _mm256_or_si256(_mm256_srli_epi64(_mm256_load_si256((const __m256i*) bits), 12), exponent);
+		__m256d d = _mm256_add_pd(base, _mm256_mul_pd(_mm256_sub_pd(_mm256_castsi256_pd(r), one), scale));
+		if(count - i >= RANDGEN_LANES / 2)
+		{
+			_mm256_storeu_pd(out + i, d);
+		}
+		else
+		{
+			alignas(32) double tail[RANDGEN_LANES / 2];
+			_mm256_store_pd(tail, d);
+			memcpy(out + i, tail, (count - i) * sizeof(double));
+		}
+	}
+}
+#else
+static inline uint32_t Rotl(uint32_t x, int k)
+{
+	return (x << k) | (x >> (32 - k));
+}
+
+void RandGen::Step(uint32_t* out)
+{
+	for(int i = 0; i < RANDGEN_LANES; ++i)
+	{
+		uint32_t s0 = m_lanes[0][i], s1 = m_lanes[1][i], s2 = m_lanes[2][i], s3 = m_lanes[3][i];
+		out[i] = Rotl(s0 + s3, 7) + s0;
+		uint32_t t = s1 << 9;
+		s2 ^= s0;
+		s3 ^= s1;
+		s1 ^= s2;
+		s0 ^= s3;
+		s2 ^= t;
+		s3 = Rotl(s3, 11);
+		m_lanes[0][i] = s0;
+		m_lanes[1][i] = s1;
+		m_lanes[2][i] = s2;
+		m_lanes[3][i] = s3;
+	}
+}
+
+void RandGen::FillFloats(float* out, size_t count, float lo, float hi)
+{
+	//Random bits under the exponent of 1.0 make a float in [1, 2), and
+	//taking the 1 off is exact
+	const float scale = hi - lo;
+	uint32_t bits[RANDGEN_LANES];
+	for(size_t i = 0; i < count; i += RANDGEN_LANES)
+	{
+		Step(bits);
+		for(size_t j = 0; j < RANDGEN_LANES && i + j < count; ++j)
+		{
+			uint32_t r = (bits[j] >> 9) | 0x3F800000;
+			float f;
+			memcpy(&f, &r, sizeof(f));
+			out[i + j] = lo + (f - 1.f) * scale;
+		}
+	}
+}
+
+void RandGen::FillDoubles(double* out, size_t count, double lo, double hi)
+{
+	//Pairs of lanes make the 64 bit words
+	const double scale = hi - lo;
+	uint32_t bits[RANDGEN_LANES];
+	for(size_t i = 0; i < count; i += RANDGEN_LANES / 2)
+	{
+		Step(bits);
+		for(size_t j = 0; j < RANDGEN_LANES / 2 && i + j < count; ++j)
+		{
+			uint64_t r = (((uint64_t) bits[2 * j + 1] << 32 | bits[2 * j]) >> 12) | 0x3FF0000000000000ull;
+			double d;
+			memcpy(&d, &r, sizeof(d));
+			out[i + j] = lo + (d - 1.0) * scale;
+		}
+	}
+}
+#endif
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+void RandStream::Next(uint32_t* out)
+{
+	uint32_t c0 = m_block++, c1 = 0, c2 = m_id[0], c3 = m_id[1];
+	uint32_t k0 = m_key[0], k1 = m_key[1];
+	for(int r = 0; r < PHILOX_ROUNDS; ++r)
+	{
+		uint64_t p0 = (uint64_t) PHILOX_M0 * c0, p1 = (uint64_t) PHILOX_M1 * c2;
+		c0 = (p1 >> 32) ^ c1 ^ k0;
+		c1 = p1;
+		c2 = (p0 >> 32) ^ c3 ^ k1;
+		c3 = p0;
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+}
+
+void RandStream::FillFloats(float* out, size_t count, float lo, float hi)
+{
+	const float scale = hi - lo;
+	uint32_t bits[4];
+	for(size_t i = 0; i < count; i += 4)
+	{
+		Next(bits);
+		for(size_t j = 0; j < 4 && i + j < count; ++j)
+		{
+			uint32_t r = (bits[j] >> 9) | 0x3F800000;
+			float f;
+			memcpy(&f, &r, sizeof(f));
+			out[i + j] = lo + (f - 1.f) * scale;
+		}
+	}
+}
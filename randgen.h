@@ -0,0 +1,98 @@
+#ifndef RANDGEN_H_
+#define RANDGEN_H_
+#include <sys/types.h>
+#include <time.h>
+#include <cstddef>
+#include <cstdint>
+
+#define RANDGEN_LANES 8
+
+//Both generators start from one seed. PRNG64 gives single draws; the
+//batch fills run RANDGEN_LANES xoshiro128++ streams side by side, one
+//SIMD step filling eight floats or four doubles. Batches come out the
+//same whichever instruction set the build targets.
+class RandGen
+{
+public:
+	//Seeded from the wall clock; GetSeed tells which run to repeat
+	RandGen()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		Seed((unsigned long long) ts.tv_sec << 32 | ts.tv_nsec);
+	}
+
+	RandGen(unsigned long long seed)
+	{
+		Seed(seed);
+	}
+
+	unsigned long long GetSeed() const
+	{
+		return m_seed;
+	}
+
+	u_int64_t PRNG64()
+	{
+		//PRNG algo by Vladimir Makarov
+		m_wyhash64 += 0x60bee2bee120fc15;
+		__uint128_t tmp;
+		tmp = (__uint128_t) m_wyhash64 * 0xa3b195354a39b70d;
+		u_int64_t m1 = (tmp >> 64) ^ tmp;
+		tmp = (__uint128_t)m1 * 0x1b03738712fad5c9;
+		u_int64_t m2 = (tmp >> 64) ^ tmp;
+		return m2;
+	}
+
+	//Uniform in [0, max)
+	double RandDouble(double max)
+	{
+		return (PRNG64() >> 11) * (1.0 / 9007199254740992.0) * max;
+	}
+
+	//Uniform in [0, 1)
+	float RandFloat()
+	{
+		return (PRNG64() >> 40) * (1.f / 16777216.f);
+	}
+
+	//Uniform between lo and hi, 23 bits of randomness per float and 52 per
+	//double. Each call consumes whole steps, so the sequence depends only
+	//on the seed and the counts asked for.
+	void FillFloats(float* out, size_t count, float lo = 0.f, float hi = 1.f);
+	void FillDoubles(double* out, size_t count, double lo = 0.0, double hi = 1.0);
+private:
+	void Seed(unsigned long long seed);
+	void Step(uint32_t* out);
+
+	unsigned long long m_seed, m_wyhash64;
+	alignas(32) uint32_t m_lanes[4][RANDGEN_LANES];
+};
+
+//Counter-based Philox4x32-10 (Salmon et al., "Parallel random numbers:
+//as easy as 1, 2, 3"). Block n of a stream is a pure function of the
+//seed, the stream's two ids and n, so entities drawing from streams keyed
+//by their ids get the same numbers in any order, on any thread.
+class RandStream
+{
+public:
+	RandStream(unsigned long long seed, uint32_t id0, uint32_t id1 = 0) :
+		m_block(0)
+	{
+		m_key[0] = seed;
+		m_key[1] = seed >> 32;
+		m_id[0] = id0;
+		m_id[1] = id1;
+	}
+
+	//Four random words, the next block of the stream
+	void Next(uint32_t* out);
+
+	//As RandGen::FillFloats, consuming whole blocks
+	void FillFloats(float* out, size_t count, float lo = 0.f, float hi = 1.f);
+private:
+	uint32_t m_key[2], m_id[2];
+	uint32_t m_block;
+};
+
+#endif
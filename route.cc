@@ -0,0 +1,462 @@
+#include "route.h"
+#include "graph.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+
+//Witness searches give up after settling this many nodes; a missed
+//witness only costs a redundant shortcut, never a wrong distance
+#define ROUTE_WITNESS_SETTLE 128
+
+typedef std::pair<float, uint32_t> QueueEntry;
+typedef std::priority_queue<QueueEntry, std::vector<QueueEntry>,
+			    std::greater<QueueEntry>> DistanceQueue;
+
+RoutePlanner::RoutePlanner() :
+	m_mem("Route planner")
+{
+	m_forward.generation = 0;
+	m_backward.generation = 0;
+}
+
+void RoutePlanner::Build(const Graph& graph)
+{
+	size_t n = graph.GetNodeCount();
+	std::vector<std::vector<Arc>> adj(n);
+	auto addarc = [&adj](uint32_t from, uint32_t to, float weight, uint32_t middle)
+	{
+		for(Arc& arc : adj[from])
+		{
+			if(arc.head == to)
+			{
+				if(weight < arc.weight)
+				{
+					arc.weight = weight;
+					arc.middle = middle;
+				}
+				return;
+			}
+		}
+		adj[from].push_back(Arc{to, weight, middle});
+	};
+
+	for(const Edge& edge : graph.GetEdges())
+	{
+		float weight = vmath::distance(graph.GetPosition(edge.i0),
+					       graph.GetPosition(edge.i1));
+		addarc(edge.i0, edge.i1, weight, ROUTE_NONE);
+		addarc(edge.i1, edge.i0, weight, ROUTE_NONE);
+	}
+
+	//Dijkstra from source that avoids skip, stopping past limit
+	std::vector<float> wdist(n, INFINITY);
+	std::vector<uint32_t> touched;
+	DistanceQueue queue;
+	auto witness = [&](uint32_t source, uint32_t skip, float limit)
+	{
+		queue = DistanceQueue();
+		wdist[source] = 0.f;
+		touched.push_back(source);
+		queue.push(QueueEntry(0.f, source));
+		for(int settled = 0; !queue.empty() && settled < ROUTE_WITNESS_SETTLE; ++settled)
+		{
+			QueueEntry top = queue.top();
+			queue.pop();
+			if(top.first > limit)
+			{
+				break;
+			}
+			if(top.first > wdist[top.second])
+			{
+				continue;
+			}
+			for(const Arc& arc : adj[top.second])
+			{
+				float d = top.first + arc.weight;
+				if(arc.head != skip && d < wdist[arc.head])
+				{
+					if(wdist[arc.head] == INFINITY)
+					{
+						touched.push_back(arc.head);
+					}
+					wdist[arc.head] = d;
+					queue.push(QueueEntry(d, arc.head));
+				}
+			}
+		}
+	};
+
+	//Shortcuts contracting v would need; only counted when out is null
+	struct Shortcut
+	{
+		uint32_t a, b;
+		float weight;
+	};
+	auto shortcuts = [&](uint32_t v, std::vector<Shortcut>* out)
+	{
+		const std::vector<Arc>& arcs = adj[v];
+		float longest = 0.f;
+		for(const Arc& arc : arcs)
+		{
+			longest = std::max(longest, arc.weight);
+		}
+
+		int count = 0;
+		for(size_t i = 0; i + 1 < arcs.size(); ++i)
+		{
+			witness(arcs[i].head, v, arcs[i].weight + longest);
+			for(size_t j = i + 1; j < arcs.size(); ++j)
+			{
+				float via = arcs[i].weight + arcs[j].weight;
+				if(wdist[arcs[j].head] > via)
+				{
+					++count;
+					if(out)
+					{
+						out->push_back(Shortcut{arcs[i].head, arcs[j].head, via});
+					}
+				}
+			}
+			for(uint32_t t : touched)
+			{
+				wdist[t] = INFINITY;
+			}
+			touched.clear();
+		}
+		return count;
+	};
+
+	//Edge difference plus the number of already contracted neighbours,
+	//which spreads the contraction evenly over the graph
+	std::vector<int> deleted(n, 0);
+	auto priority = [&](uint32_t v)
+	{
+		return shortcuts(v, 0) - (int) adj[v].size() + deleted[v];
+	};
+
+	typedef std::pair<int, uint32_t> Candidate;
+	std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> order;
+	for(uint32_t v = 0; v < n; ++v)
+	{
+		order.push(Candidate(priority(v), v));
+	}
+
+	std::vector<std::vector<Arc>> up(n);
+	std::vector<char> contracted(n, 0);
+	std::vector<Shortcut> added;
+	m_rank.assign(n, 0);
+	uint32_t nextrank = 0;
+	while(!order.empty())
+	{
+		uint32_t v = order.top().second;
+		order.pop();
+		if(contracted[v])
+		{
+			continue;
+		}
+
+		//Lazy update: priorities only grow stale upwards in practice, so
+		//a node is requeued if it no longer beats the next candidate
+		int current = priority(v);
+		if(!order.empty() && current > order.top().first)
+		{
+			order.push(Candidate(current, v));
+			continue;
+		}
+
+		m_rank[v] = nextrank++;
+		contracted[v] = 1;
+		added.clear();
+		shortcuts(v, &added);
+		for(const Arc& arc : adj[v])
+		{
+			std::vector<Arc>& back = adj[arc.head];
+			for(size_t i = 0; i < back.size(); ++i)
+			{
+				if(back[i].head == v)
+				{
+					back[i] = back.back();
+					back.pop_back();
+					break;
+				}
+			}
+			++deleted[arc.head];
+		}
+		for(const Shortcut& s : added)
+		{
+			addarc(s.a, s.b, s.weight, v);
+			addarc(s.b, s.a, s.weight, v);
+		}
+		up[v].swap(adj[v]);
+	}
+
+	m_first.resize(n + 1);
+	m_arcs.clear();
+	for(size_t v = 0; v < n; ++v)
+	{
+		m_first[v] = m_arcs.size();
+		m_arcs.insert(m_arcs.end(), up[v].begin(), up[v].end());
+	}
+	m_first[n] = m_arcs.size();
+
+	InitSearch(m_forward);
+	InitSearch(m_backward);
+	UpdateMemory();
+}
+
+void RoutePlanner::InitSearch(Search& search)
+{
+	size_t n = m_rank.size();
+	search.dist.assign(n, INFINITY);
+	search.parent.assign(n, ROUTE_NONE);
+	search.from.assign(n, ROUTE_NONE);
+	search.stamp.assign(n, 0);
+	search.generation = 0;
+}
+
+void RoutePlanner::UpdateMemory()
+{
+	size_t searchbytes = 0;
+	for(const Search* pSearch : {&m_forward, &m_backward})
+	{
+		searchbytes += pSearch->dist.capacity() * sizeof(float) +
+			(pSearch->parent.capacity() + pSearch->from.capacity() +
+			 pSearch->stamp.capacity()) * sizeof(uint32_t);
+	}
+	m_mem.SetCPU((m_first.capacity() + m_rank.capacity()) * sizeof(uint32_t) +
+		     m_arcs.capacity() * sizeof(Arc) + searchbytes);
+}
+
+static void NextGeneration(std::vector<uint32_t>& stamp, uint32_t& generation)
+{
+	if(++generation == 0)
+	{
+		std::fill(stamp.begin(), stamp.end(), 0);
+		generation = 1;
+	}
+}
+
+float RoutePlanner::Query(uint32_t a, uint32_t b, std::vector<uint32_t>* pPath)
+{
+	if(pPath)
+	{
+		pPath->clear();
+	}
+	if(a >= m_rank.size() || b >= m_rank.size())
+	{
+		return INFINITY;
+	}
+
+	Search* searches[2] = {&m_forward, &m_backward};
+	DistanceQueue queues[2];
+	uint32_t sources[2] = {a, b};
+	for(int side = 0; side < 2; ++side)
+	{
+		Search& search = *searches[side];
+		NextGeneration(search.stamp, search.generation);
+		search.stamp[sources[side]] = search.generation;
+		search.dist[sources[side]] = 0.f;
+		search.parent[sources[side]] = ROUTE_NONE;
+		queues[side].push(QueueEntry(0.f, sources[side]));
+	}
+
+	//Both searches only climb, so neither can stop at the first meeting;
+	//each runs until its queue holds nothing shorter than the best route
+	float best = INFINITY;
+	uint32_t meet = ROUTE_NONE;
+	for(int side = 0; !queues[0].empty() || !queues[1].empty(); side ^= 1)
+	{
+		DistanceQueue& queue = queues[side];
+		if(queue.empty() || queue.top().first >= best)
+		{
+			DistanceQueue& other = queues[side ^ 1];
+			if(other.empty() || other.top().first >= best)
+			{
+				break;
+			}
+			continue;
+		}
+
+		Search& search = *searches[side];
+		Search& opposite = *searches[side ^ 1];
+		QueueEntry top = queue.top();
+		queue.pop();
+		uint32_t u = top.second;
+		if(top.first > search.dist[u])
+		{
+			continue;
+		}
+		if(opposite.stamp[u] == opposite.generation && top.first + opposite.dist[u] < best)
+		{
+			best = top.first + opposite.dist[u];
+			meet = u;
+		}
+
+		for(uint32_t i = m_first[u]; i < m_first[u + 1]; ++i)
+		{
+			const Arc& arc = m_arcs[i];
+			float d = top.first + arc.weight;
+			if(search.stamp[arc.head] != search.generation || d < search.dist[arc.head])
+			{
+				search.stamp[arc.head] = search.generation;
+				search.dist[arc.head] = d;
+				search.parent[arc.head] = i;
+				search.from[arc.head] = u;
+				queue.push(QueueEntry(d, arc.head));
+			}
+		}
+	}
+
+	if(pPath && meet != ROUTE_NONE)
+	{
+		//Climb from the meeting node back down to a, then unpack each
+		//arc in travel order, then do the same towards b
+		std::vector<uint32_t> chain;
+		for(uint32_t u = meet; u != a; u = m_forward.from[u])
+		{
+			chain.push_back(u);
+		}
+		pPath->push_back(a);
+		for(size_t i = chain.size(); i-- > 0;)
+		{
+			Unpack(m_forward.from[chain[i]], m_forward.parent[chain[i]], *pPath);
+		}
+		for(uint32_t u = meet; u != b; u = m_backward.from[u])
+		{
+			Unpack(u, m_backward.parent[u], *pPath);
+		}
+	}
+	return best;
+}
+
+uint32_t RoutePlanner::FindArc(uint32_t lower, uint32_t upper) const
+{
+	for(uint32_t i = m_first[lower]; i < m_first[lower + 1]; ++i)
+	{
+		if(m_arcs[i].head == upper)
+		{
+			return i;
+		}
+	}
+	return ROUTE_NONE;
+}
+
+void RoutePlanner::Unpack(uint32_t from, uint32_t arc, std::vector<uint32_t>& path) const
+{
+	//Appends the original nodes after from along arc, whichever end of the
+	//arc from is. A shortcut over m expands into from-m and m-to, and both
+	//halves are stored at m since it was contracted first.
+	struct Step
+	{
+		uint32_t from, to, arc;
+	};
+	const Arc& first = m_arcs[arc];
+	uint32_t to = first.head == from ? ROUTE_NONE : first.head;
+	if(to == ROUTE_NONE)
+	{
+		//The arc is stored at the far end
+		to = std::upper_bound(m_first.begin(), m_first.end(), arc) - m_first.begin() - 1;
+	}
+
+	std::vector<Step> stack;
+	stack.push_back(Step{from, to, arc});
+	while(!stack.empty())
+	{
+		Step step = stack.back();
+		stack.pop_back();
+		uint32_t middle = m_arcs[step.arc].middle;
+		if(middle == ROUTE_NONE)
+		{
+			path.push_back(step.to);
+			continue;
+		}
+		stack.push_back(Step{middle, step.to, FindArc(middle, step.to)});
+		stack.push_back(Step{step.from, middle, FindArc(middle, step.from)});
+	}
+}
+
+void RoutePlanner::UpwardSearch(uint32_t source, Search& search, std::vector<uint32_t>& settled)
+{
+	settled.clear();
+	NextGeneration(search.stamp, search.generation);
+	search.stamp[source] = search.generation;
+	search.dist[source] = 0.f;
+
+	DistanceQueue queue;
+	queue.push(QueueEntry(0.f, source));
+	while(!queue.empty())
+	{
+		QueueEntry top = queue.top();
+		queue.pop();
+		uint32_t u = top.second;
+		if(top.first > search.dist[u])
+		{
+			continue;
+		}
+		settled.push_back(u);
+		for(uint32_t i = m_first[u]; i < m_first[u + 1]; ++i)
+		{
+			const Arc& arc = m_arcs[i];
+			float d = top.first + arc.weight;
+			if(search.stamp[arc.head] != search.generation || d < search.dist[arc.head])
+			{
+				search.stamp[arc.head] = search.generation;
+				search.dist[arc.head] = d;
+				queue.push(QueueEntry(d, arc.head));
+			}
+		}
+	}
+}
+
+void RoutePlanner::DistanceTable(const std::vector<uint32_t>& sources,
+				 const std::vector<uint32_t>& targets,
+				 std::vector<float>& out)
+{
+	struct Bucket
+	{
+		uint32_t node, target;
+		float dist;
+
+		bool operator<(const Bucket& other) const
+		{
+			return node < other.node;
+		}
+	};
+
+	std::vector<Bucket> buckets;
+	std::vector<uint32_t> settled;
+	for(uint32_t j = 0; j < targets.size(); ++j)
+	{
+		if(targets[j] >= m_rank.size())
+		{
+			continue;
+		}
+		UpwardSearch(targets[j], m_backward, settled);
+		for(uint32_t u : settled)
+		{
+			buckets.push_back(Bucket{u, j, m_backward.dist[u]});
+		}
+	}
+	std::sort(buckets.begin(), buckets.end());
+
+	out.assign(sources.size() * targets.size(), INFINITY);
+	for(size_t i = 0; i < sources.size(); ++i)
+	{
+		if(sources[i] >= m_rank.size())
+		{
+			continue;
+		}
+		float* row = &out[i * targets.size()];
+		UpwardSearch(sources[i], m_forward, settled);
+		for(uint32_t u : settled)
+		{
+			Bucket key = {u, 0, 0.f};
+			auto range = std::equal_range(buckets.begin(), buckets.end(), key);
+			for(auto it = range.first; it != range.second; ++it)
+			{
+				row[it->target] = std::min(row[it->target], m_forward.dist[u] + it->dist);
+			}
+		}
+	}
+}
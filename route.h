@@ -0,0 +1,73 @@
+#ifndef ROUTE_H_
+#define ROUTE_H_
+#include <vector>
+#include <cstdint>
+#include "memstats.h"
+
+#define ROUTE_NONE 0xFFFFFFFFu
+
+class Graph;
+
+//Shortest paths over a Graph's edges, weighted by Euclidean length, using
+//a contraction hierarchy. Build contracts the nodes one at a time in order
+//of edge difference, adding a shortcut between two neighbours whenever a
+//bounded witness search finds no path around the contracted node. Queries
+//are then a bidirectional Dijkstra that only climbs to higher ranked
+//nodes, which settles a few hundred nodes even on millions of stars.
+//The hierarchy is a snapshot: rebuild it after the graph changes.
+class RoutePlanner
+{
+public:
+	RoutePlanner();
+
+	void Build(const Graph& graph);
+
+	bool IsBuilt() const
+	{
+		return !m_first.empty();
+	}
+
+	//Length of the shortest path from a to b, INFINITY if there is none.
+	//pPath receives the nodes along it, a and b included.
+	float Query(uint32_t a, uint32_t b, std::vector<uint32_t>* pPath = 0);
+
+	//out[i * targets.size() + j] is the distance from sources[i] to
+	//targets[j]. Each endpoint is searched once, with the target searches
+	//left in per-node buckets that the source searches then scan.
+	void DistanceTable(const std::vector<uint32_t>& sources,
+			   const std::vector<uint32_t>& targets,
+			   std::vector<float>& out);
+private:
+	struct Arc
+	{
+		uint32_t head;
+		float weight;
+		uint32_t middle; //Contracted node a shortcut skips, ROUTE_NONE if original
+	};
+
+	struct Search
+	{
+		std::vector<float> dist;
+		std::vector<uint32_t> parent; //Arc index into m_arcs that reached the node
+		std::vector<uint32_t> from; //Node at the other end of that arc
+		std::vector<uint32_t> stamp;
+		uint32_t generation;
+	};
+
+	void InitSearch(Search& search);
+	void UpwardSearch(uint32_t source, Search& search, std::vector<uint32_t>& settled);
+	uint32_t FindArc(uint32_t lower, uint32_t upper) const;
+	void Unpack(uint32_t from, uint32_t arc, std::vector<uint32_t>& path) const;
+	void UpdateMemory();
+
+	//Upward graph in compressed rows: the arcs of node v, all leading to
+	//higher ranked nodes, are m_arcs[m_first[v] .. m_first[v + 1])
+	std::vector<uint32_t> m_first;
+	std::vector<Arc> m_arcs;
+	std::vector<uint32_t> m_rank;
+
+	Search m_forward, m_backward;
+	MemCounter m_mem;
+};
+
+#endif
@@ -0,0 +1,14 @@
+#version 400
+
+layout(location = 0) in vec4 vp;
+layout(location = 1) in vec4 incol;
+
+uniform mat4x4 projviewmodelMat;
+out vec4 color;
+
+void main()
+{
+	//Routes share the stars' vertices and are drawn over the grey edges
+	gl_Position =  projviewmodelMat * vp;
+	color = vec4(1.0, 0.6, 0.1, 1.0);
+};
@@ -0,0 +1,180 @@
+#include "sap.h"
+#include <algorithm>
+#include "morton.h"
+#include "ssemath.h"
+#include "threadpool.h"
+
+#define SAP_SWEEP_GRAIN 4096
+//Insertion sort shifts per point before falling back to a full sort
+#define SAP_MAX_SHIFTS 8
+
+SweepAndPrune::SweepAndPrune() :
+	m_mem("Sweep and prune")
+{
+}
+
+void SweepAndPrune::Update(const Vertex* verts, size_t count, float distance, ThreadPool* pPool)
+{
+	//Boxes reach distance out, so two overlap whenever the points are
+	//within distance on every axis
+	m_lox.resize(count);
+	for(size_t i = 0; i < count; ++i)
+	{
+		m_lox[i] = verts[i].vertex[0] - distance;
+	}
+
+	auto byLox = [this](uint32_t a, uint32_t b)
+	{
+		return m_lox[a] < m_lox[b];
+	};
+	bool bSorted = false;
+	if(m_order.size() != count)
+	{
+		m_order.resize(count);
+		for(size_t i = 0; i < count; ++i)
+		{
+			m_order[i] = i;
+		}
+		//Indices may mean other points now, so every pair starts afresh
+		m_pairs.clear();
+	}
+	else
+	{
+		//Coherent frames take a few shifts per point; a jump in time
+		//reshuffles the order, and past the limit a full sort is cheaper
+		size_t shifts = 0, limit = SAP_MAX_SHIFTS * count;
+		bSorted = true;
+		for(size_t i = 1; i < count && bSorted; ++i)
+		{
+			uint32_t id = m_order[i];
+			float key = m_lox[id];
+			size_t j = i;
+			for(; j > 0 && m_lox[m_order[j - 1]] > key; --j)
+			{
+				m_order[j] = m_order[j - 1];
+			}
+			m_order[j] = id;
+			shifts += i - j;
+			bSorted = shifts <= limit;
+		}
+	}
+	if(!bSorted)
+	{
+		std::sort(m_order.begin(), m_order.end(), byLox);
+	}
+
+	m_minx.resize(count);
+	m_maxx.resize(count);
+	m_miny.resize(count);
+	m_maxy.resize(count);
+	m_minz.resize(count);
+	m_maxz.resize(count);
+	m_x.resize(count);
+	m_y.resize(count);
+	m_z.resize(count);
+	for(size_t i = 0; i < count; ++i)
+	{
+		const vmath::vec4& v = verts[m_order[i]].vertex;
+		m_x[i] = v[0];
+		m_y[i] = v[1];
+		m_z[i] = v[2];
+		m_minx[i] = m_lox[m_order[i]];
+		m_maxx[i] = v[0] + distance;
+		m_miny[i] = v[1] - distance;
+		m_maxy[i] = v[1] + distance;
+		m_minz[i] = v[2] - distance;
+		m_maxz[i] = v[2] + distance;
+	}
+
+	//Each box against the later ones it overlaps along x. Chunks of the
+	//sweep run on the pool and their pairs are joined in order.
+	const float distance2 = distance * distance;
+	size_t chunks = (count + SAP_SWEEP_GRAIN - 1) / SAP_SWEEP_GRAIN;
+	std::vector<std::vector<uint64_t>> parts(chunks);
+	auto sweep = [&](size_t first, size_t last)
+	{
+		std::vector<uint32_t> hits;
+		for(size_t c = first; c < last; ++c)
+		{
+			std::vector<uint64_t>& part = parts[c];
+			size_t end = std::min((c + 1) * SAP_SWEEP_GRAIN, count);
+			for(size_t i = c * SAP_SWEEP_GRAIN; i < end; ++i)
+			{
+				size_t run = i + 1;
+				while(run < count && m_minx[run] <= m_maxx[i])
+				{
+					++run;
+				}
+				if(run == i + 1)
+				{
+					continue;
+				}
+				hits.resize(run - i - 1);
+				size_t n = BoxOverlapBatch(&m_miny[i + 1], &m_maxy[i + 1], &m_minz[i + 1],
+							   &m_maxz[i + 1], run - i - 1, m_miny[i], m_maxy[i],
+							   m_minz[i], m_maxz[i], &hits[0]);
+				for(size_t h = 0; h < n; ++h)
+				{
+					size_t j = i + 1 + hits[h];
+					float dx = m_x[j] - m_x[i], dy = m_y[j] - m_y[i], dz = m_z[j] - m_z[i];
+					if(dx * dx + dy * dy + dz * dz > distance2)
+					{
+						continue;
+					}
+					uint64_t a = m_order[i], b = m_order[j];
+					part.push_back(a < b ? (a << 32 | b) : (b << 32 | a));
+				}
+			}
+		}
+	};
+	if(pPool)
+	{
+		pPool->ParallelFor(0, chunks, 1, sweep);
+	}
+	else if(chunks)
+	{
+		sweep(0, chunks);
+	}
+
+	m_last.swap(m_pairs);
+	m_pairs.clear();
+	for(const std::vector<uint64_t>& part : parts)
+	{
+		m_pairs.insert(m_pairs.end(), part.begin(), part.end());
+	}
+	m_values.resize(m_pairs.size());
+	RadixSort(m_pairs, m_values, pPool);
+
+	//Both lists are sorted, so the events fall out of one merge
+	m_begun.clear();
+	m_ended.clear();
+	size_t i = 0, j = 0;
+	while(i < m_pairs.size() || j < m_last.size())
+	{
+		if(j == m_last.size() || (i < m_pairs.size() && m_pairs[i] < m_last[j]))
+		{
+			m_begun.push_back(m_pairs[i++]);
+		}
+		else if(i == m_pairs.size() || m_last[j] < m_pairs[i])
+		{
+			m_ended.push_back(m_last[j++]);
+		}
+		else
+		{
+			++i;
+			++j;
+		}
+	}
+	UpdateMemory();
+}
+
+void SweepAndPrune::UpdateMemory()
+{
+	m_mem.SetCPU((m_order.capacity() + m_values.capacity()) * sizeof(uint32_t) +
+		     (m_lox.capacity() + m_minx.capacity() + m_maxx.capacity() +
+		      m_miny.capacity() + m_maxy.capacity() + m_minz.capacity() +
+		      m_maxz.capacity() + m_x.capacity() + m_y.capacity() + m_z.capacity()) *
+		     sizeof(float) +
+		     (m_pairs.capacity() + m_last.capacity() + m_begun.capacity() +
+		      m_ended.capacity()) * sizeof(uint64_t));
+}
@@ -0,0 +1,63 @@
+#ifndef SAP_H_
+#define SAP_H_
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "vertex.h"
+#include "memstats.h"
+
+class ThreadPool;
+
+//Pairs are keyed as (a << 32) | b with a < b
+#define SAP_PAIR_FIRST(key) ((uint32_t) ((key) >> 32))
+#define SAP_PAIR_SECOND(key) ((uint32_t) (key))
+
+//Sweep-and-prune broadphase for close approaches between moving points.
+//Each point gets a box reaching distance out on every axis, and the boxes
+//are kept sorted by their low x edge. Between frames the order barely
+//changes, so an insertion sort restores it in close to linear time, and
+//a full sort takes over when a jump in time scrambles it. The
+//sweep then tests each box against the run of later boxes overlapping it
+//along x, eight or sixteen at a time on y and z, and candidates are
+//confirmed by their true distance. The pairs are diffed against the last
+//frame's to report which approaches began and ended.
+class SweepAndPrune
+{
+public:
+	SweepAndPrune();
+
+	//Positions of count points this frame; pairs closer than distance
+	//are reported. A change in count restarts the sort from scratch, and
+	//every pair found then is reported as begun.
+	void Update(const Vertex* verts, size_t count, float distance, ThreadPool* pPool = 0);
+
+	//Every pair within distance, sorted
+	const std::vector<uint64_t>& GetPairs() const
+	{
+		return m_pairs;
+	}
+
+	//Pairs that came within distance, or left it, in the last Update
+	const std::vector<uint64_t>& GetBegun() const
+	{
+		return m_begun;
+	}
+
+	const std::vector<uint64_t>& GetEnded() const
+	{
+		return m_ended;
+	}
+private:
+	void UpdateMemory();
+
+	std::vector<uint32_t> m_order; //Point indices by low x edge
+	std::vector<float> m_lox; //Low x edge of each point, by index
+	//Boxes and centres in sweep order
+	std::vector<float> m_minx, m_maxx, m_miny, m_maxy, m_minz, m_maxz;
+	std::vector<float> m_x, m_y, m_z;
+	std::vector<uint64_t> m_pairs, m_last, m_begun, m_ended;
+	std::vector<uint32_t> m_values; //Unused payload for the pair sort
+	MemCounter m_mem;
+};
+
+#endif
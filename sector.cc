@@ -0,0 +1,193 @@
+#include "sector.h"
+#include <algorithm>
+#include <cmath>
+#include "randgen.h"
+
+//Bits of each sector coordinate in a key, biased to be unsigned
+#define SECTOR_KEY_BITS 21
+#define SECTOR_KEY_BIAS (1 << (SECTOR_KEY_BITS - 1))
+
+SectorStreamer::SectorStreamer(unsigned long long seed, size_t budget, ThreadPool* pPool) :
+	m_seed(seed),
+	m_pPool(pPool),
+	m_slots(std::max<size_t>(budget / (SECTOR_STARS * sizeof(Vertex)), 1)),
+	m_frame(0),
+	m_mem("Sectors")
+{
+	m_free.resize(m_slots);
+	for(size_t i = 0; i < m_slots; ++i)
+	{
+		m_free[i] = m_slots - 1 - i;
+	}
+
+	for(int z = -SECTOR_RADIUS; z <= SECTOR_RADIUS; ++z)
+	{
+		for(int y = -SECTOR_RADIUS; y <= SECTOR_RADIUS; ++y)
+		{
+			for(int x = -SECTOR_RADIUS; x <= SECTOR_RADIUS; ++x)
+			{
+				m_offsets.push_back(vmath::ivec3(x, y, z));
+			}
+		}
+	}
+	std::stable_sort(m_offsets.begin(), m_offsets.end(),
+			 [](const vmath::ivec3& a, const vmath::ivec3& b)
+			 {
+				 return a[0] * a[0] + a[1] * a[1] + a[2] * a[2] <
+					 b[0] * b[0] + b[1] * b[1] + b[2] * b[2];
+			 });
+}
+
+SectorStreamer::~SectorStreamer()
+{
+	//Generations in flight write into their Pending
+	for(const std::unique_ptr<Pending>& p : m_pending)
+	{
+		m_pPool->Wait(p->task);
+	}
+}
+
+uint64_t SectorStreamer::Key(int x, int y, int z)
+{
+	const uint64_t mask = (1ull << SECTOR_KEY_BITS) - 1;
+	return ((uint64_t) (x + SECTOR_KEY_BIAS) & mask) |
+		((uint64_t) (y + SECTOR_KEY_BIAS) & mask) << SECTOR_KEY_BITS |
+		((uint64_t) (z + SECTOR_KEY_BIAS) & mask) << (2 * SECTOR_KEY_BITS);
+}
+
+void SectorStreamer::Generate(uint64_t key, int x, int y, int z, std::vector<Vertex>& verts) const
+{
+	//Between an eighth of the slot and all of it, spread evenly over the
+	//sector; the rest of the slot is hidden
+	RandStream rng(m_seed, key, key >> 32);
+	float head;
+	rng.FillFloats(&head, 1);
+	size_t count = SECTOR_STARS / 8 + (size_t) (head * (SECTOR_STARS - SECTOR_STARS / 8 + 1));
+	count = std::min<size_t>(count, SECTOR_STARS);
+	float r[6 * SECTOR_STARS];
+	rng.FillFloats(r, 6 * count);
+
+	vmath::vec3 lo((x - 0.5f) * SECTOR_SIZE, (y - 0.5f) * SECTOR_SIZE, (z - 0.5f) * SECTOR_SIZE);
+	verts.clear();
+	verts.reserve(SECTOR_STARS);
+	for(size_t i = 0; i < count; ++i)
+	{
+		const float* s = &r[6 * i];
+		verts.emplace_back(vmath::Tvec4<unsigned char>(s[3] * 256.f, s[4] * 256.f, s[5] * 256.f, 255),
+				   vmath::vec4(lo[0] + s[0] * SECTOR_SIZE, lo[1] + s[1] * SECTOR_SIZE,
+					       lo[2] + s[2] * SECTOR_SIZE, 1.f));
+	}
+	while(verts.size() < SECTOR_STARS)
+	{
+		verts.emplace_back(vmath::Tvec4<unsigned char>(0, 0, 0, 0), vmath::vec4(lo[0], lo[1], lo[2], 1.f));
+	}
+}
+
+bool SectorStreamer::Evictable() const
+{
+	return !m_lru.empty() && m_resident.find(m_lru.back())->second.wanted != m_frame;
+}
+
+void SectorStreamer::Update(const vmath::vec3& eye, Vertex* verts, std::vector<uint32_t>& changed)
+{
+	++m_frame;
+	int cx = floorf(eye[0] / SECTOR_SIZE + 0.5f);
+	int cy = floorf(eye[1] / SECTOR_SIZE + 0.5f);
+	int cz = floorf(eye[2] / SECTOR_SIZE + 0.5f);
+
+	//Wanted sectors already loaded move to the front of the LRU list
+	std::vector<vmath::ivec3> missing;
+	for(const vmath::ivec3& o : m_offsets)
+	{
+		int x = cx + o[0], y = cy + o[1], z = cz + o[2];
+		if(!x && !y && !z)
+		{
+			continue;
+		}
+		uint64_t key = Key(x, y, z);
+		auto it = m_resident.find(key);
+		if(it != m_resident.end())
+		{
+			it->second.wanted = m_frame;
+			m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+		}
+		else if(std::none_of(m_pending.begin(), m_pending.end(),
+				     [key](const std::unique_ptr<Pending>& p)
+				     {
+					     return p->key == key;
+				     }))
+		{
+			missing.push_back(vmath::ivec3(x, y, z));
+		}
+	}
+
+	//Finished sectors take a free slot or the least recently wanted one's;
+	//when every slot is wanted the budget is too small and they are dropped
+	size_t placed = 0;
+	for(size_t i = 0; i < m_pending.size() && placed < SECTOR_PLACE_PER_UPDATE;)
+	{
+		Pending& p = *m_pending[i];
+		if(!p.task->bDone.load())
+		{
+			++i;
+			continue;
+		}
+
+		bool bRoom = true;
+		uint32_t slot = 0;
+		if(!m_free.empty())
+		{
+			slot = m_free.back();
+			m_free.pop_back();
+		}
+		else if(Evictable())
+		{
+			slot = m_resident[m_lru.back()].slot;
+			m_resident.erase(m_lru.back());
+			m_lru.pop_back();
+		}
+		else
+		{
+			bRoom = false;
+		}
+
+		if(bRoom)
+		{
+			std::copy(p.verts.begin(), p.verts.end(), verts + slot * SECTOR_STARS);
+			m_lru.push_front(p.key);
+			Resident& r = m_resident[p.key];
+			r.slot = slot;
+			r.lru = m_lru.begin();
+			r.wanted = m_frame;
+			changed.push_back(slot);
+			++placed;
+		}
+		m_pending.erase(m_pending.begin() + i);
+	}
+
+	//Nearest missing sectors first, while there is somewhere to put them
+	for(const vmath::ivec3& c : missing)
+	{
+		if(m_pending.size() >= SECTOR_MAX_PENDING || (m_free.size() <= m_pending.size() && !Evictable()))
+		{
+			break;
+		}
+		std::unique_ptr<Pending> p(new Pending);
+		p->key = Key(c[0], c[1], c[2]);
+		Pending* pPending = p.get();
+		p->task = m_pPool->Submit([this, pPending, c]
+					  {
+						  Generate(pPending->key, c[0], c[1], c[2], pPending->verts);
+					  });
+		if(m_pPool->GetThreadCount() == 1)
+		{
+			//No workers to generate in the background
+			m_pPool->Wait(pPending->task);
+		}
+		m_pending.push_back(std::move(p));
+	}
+
+	m_mem.SetCPU(m_pending.size() * SECTOR_STARS * sizeof(Vertex) +
+		     m_resident.size() * (sizeof(Resident) + sizeof(uint64_t) + 2 * sizeof(void*)) +
+		     m_free.capacity() * sizeof(uint32_t));
+}
@@ -0,0 +1,90 @@
+#ifndef SECTOR_H_
+#define SECTOR_H_
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include "vmath.h"
+#include "vertex.h"
+#include "memstats.h"
+#include "threadpool.h"
+
+//Edge of a sector; the one around the origin is the hand-made scene and
+//is never generated
+#define SECTOR_SIZE 2.f
+//Most stars in one sector, and so the vertices of one slot
+#define SECTOR_STARS 64
+//Sectors kept loaded in each direction from the one holding the eye
+#define SECTOR_RADIUS 3
+//Generations in flight, and finished sectors placed per Update
+#define SECTOR_MAX_PENDING 32
+#define SECTOR_PLACE_PER_UPDATE 16
+
+//Unbounded star field streamed around the eye in cubic sectors. Each
+//sector is generated from the seed and its coordinates alone, on the
+//pool, and lands in one of a fixed number of slots of SECTOR_STARS
+//vertices, unused ones hidden with alpha 0. The slots are what the memory
+//budget buys: once they are full, the least recently wanted sector gives
+//its slot up, and comes back identical if the eye returns.
+class SectorStreamer
+{
+public:
+	//budget is the bytes of vertices the slots may hold
+	SectorStreamer(unsigned long long seed, size_t budget, ThreadPool* pPool);
+	~SectorStreamer();
+
+	//Vertices of every slot together, fixed for the streamer's life
+	size_t GetVertexCount() const
+	{
+		return m_slots * SECTOR_STARS;
+	}
+
+	//Wants the sectors around eye, nearest first, and places the finished
+	//ones into verts, which holds GetVertexCount vertices. The slots whose
+	//vertices changed are appended to changed.
+	void Update(const vmath::vec3& eye, Vertex* verts, std::vector<uint32_t>& changed);
+
+	size_t GetResidentCount() const
+	{
+		return m_resident.size();
+	}
+
+	size_t GetPendingCount() const
+	{
+		return m_pending.size();
+	}
+private:
+	struct Resident
+	{
+		uint32_t slot;
+		std::list<uint64_t>::iterator lru;
+		unsigned int wanted; //Update that last wanted it
+	};
+
+	struct Pending
+	{
+		uint64_t key;
+		std::vector<Vertex> verts;
+		ThreadPool::TaskHandle task;
+	};
+
+	static uint64_t Key(int x, int y, int z);
+	void Generate(uint64_t key, int x, int y, int z, std::vector<Vertex>& verts) const;
+	//Whether the least recently wanted sector is unwanted by this Update
+	bool Evictable() const;
+
+	unsigned long long m_seed;
+	ThreadPool* m_pPool;
+	size_t m_slots;
+	std::vector<uint32_t> m_free;
+	std::unordered_map<uint64_t, Resident> m_resident;
+	std::list<uint64_t> m_lru; //Most recently wanted first
+	std::vector<std::unique_ptr<Pending>> m_pending;
+	std::vector<vmath::ivec3> m_offsets; //Neighbourhood, nearest first
+	unsigned int m_frame;
+	MemCounter m_mem;
+};
+
+#endif
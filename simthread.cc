@@ -0,0 +1,99 @@
+#include "simthread.h"
+#include <algorithm>
+#include "planetoid.h"
+
+SimThread::SimThread(PlanetoidStore* pStore, const std::vector<Vertex>& verts, double step,
+		     ThreadPool* pPool) :
+	m_pStore(pStore),
+	m_pPool(pPool),
+	m_last(verts),
+	m_step(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		       std::chrono::duration<double>(step))),
+	m_stepsecs(step),
+	m_warp(1.0),
+	m_scrub(0.0),
+	m_time(0.0),
+	m_bQuit(false),
+	m_mem("Simulation")
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	for(int i = 0; i < 3; ++i)
+	{
+		SimFrame& frame = m_frames.GetSlot(i);
+		frame.prev = verts;
+		frame.curr = verts;
+		frame.prevtime = frame.time = 0.0;
+		frame.stamp = now;
+	}
+	m_mem.SetCPU(7 * verts.size() * sizeof(Vertex));
+	m_thread = std::thread(&SimThread::Run, this);
+}
+
+SimThread::~SimThread()
+{
+	m_bQuit.store(true);
+	m_thread.join();
+}
+
+void SimThread::Scrub(double seconds)
+{
+	double scrub = m_scrub.load();
+	while(!m_scrub.compare_exchange_weak(scrub, scrub + seconds))
+	{
+	}
+}
+
+void SimThread::Run()
+{
+	double time = 0.0, lasttime = 0.0;
+	std::chrono::steady_clock::time_point due = std::chrono::steady_clock::now();
+	while(!m_bQuit.load())
+	{
+		std::this_thread::sleep_until(due + m_step);
+
+		//Steps missed while the machine was busy are caught up at once;
+		//the orbits are closed form, so only the last one is evaluated
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		long steps = std::max<long>(1, (now - due) / m_step);
+		due += steps * m_step;
+		double scrub = m_scrub.exchange(0.0);
+		time += steps * m_stepsecs * m_warp.load() + scrub;
+
+		SimFrame& frame = m_frames.Back();
+		m_pStore->Evaluate(time, frame.curr.data(), m_pPool);
+		//A jump shows up at once rather than as a streak across the step
+		if(steps == 1 && scrub == 0.0)
+		{
+			frame.prev.swap(m_last);
+			frame.prevtime = lasttime;
+		}
+		else
+		{
+			frame.prev = frame.curr;
+			frame.prevtime = time;
+		}
+		m_last = frame.curr;
+		lasttime = time;
+		frame.time = time;
+		frame.stamp = due;
+		m_frames.Publish();
+		m_time.store(time);
+	}
+}
+
+double SimThread::Interpolate(Vertex* verts)
+{
+	const SimFrame& frame = m_frames.Front();
+	float alpha = std::chrono::duration<double>(std::chrono::steady_clock::now() - frame.stamp).count() / m_stepsecs;
+	alpha = std::min(std::max(alpha, 0.f), 1.f);
+	const Vertex* prev = frame.prev.data();
+	const Vertex* curr = frame.curr.data();
+	for(size_t i = 0; i < frame.curr.size(); ++i)
+	{
+		for(int d = 0; d < 3; ++d)
+		{
+			verts[i].vertex[d] = prev[i].vertex[d] + (curr[i].vertex[d] - prev[i].vertex[d]) * alpha;
+		}
+	}
+	return frame.prevtime + (frame.time - frame.prevtime) * alpha;
+}
@@ -0,0 +1,122 @@
+#ifndef SIMTHREAD_H_
+#define SIMTHREAD_H_
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include "vertex.h"
+#include "memstats.h"
+
+class PlanetoidStore;
+class ThreadPool;
+
+#define TRIPLE_INDEX 3u
+#define TRIPLE_FRESH 4u
+
+//Single producer, single consumer handoff of whole states. The writer
+//fills the back slot and publishes it by swapping it with the middle one;
+//the reader swaps its front slot with the middle one whenever a fresh
+//state is there. Neither side ever waits, and the reader always sees the
+//newest complete state.
+template<typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() :
+		m_back(0),
+		m_front(1),
+		m_middle(2)
+	{
+	}
+
+	T& GetSlot(int i)
+	{
+		return m_slots[i];
+	}
+
+	//Writer side
+	T& Back()
+	{
+		return m_slots[m_back];
+	}
+
+	void Publish()
+	{
+		m_back = m_middle.exchange(m_back | TRIPLE_FRESH, std::memory_order_acq_rel) & TRIPLE_INDEX;
+	}
+
+	//Reader side; the newest published state, or the last one read
+	const T& Front()
+	{
+		if(m_middle.load(std::memory_order_relaxed) & TRIPLE_FRESH)
+		{
+			m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & TRIPLE_INDEX;
+		}
+		return m_slots[m_front];
+	}
+private:
+	T m_slots[3];
+	unsigned int m_back, m_front;
+	std::atomic<unsigned int> m_middle;
+};
+
+//Planetoid state published by the simulation: positions after the last
+//step and the one before, for the renderer to blend between
+struct SimFrame
+{
+	std::vector<Vertex> prev, curr;
+	double prevtime, time; //Orbital times of prev and curr
+	std::chrono::steady_clock::time_point stamp; //When curr became due
+};
+
+//Runs the planetoid simulation on its own thread in fixed steps of wall
+//time, independent of the render rate. The renderer draws one step
+//behind, blending the last two states by how far it is into the step, so
+//motion stays smooth whether frames are faster or slower than steps.
+class SimThread
+{
+public:
+	SimThread(PlanetoidStore* pStore, const std::vector<Vertex>& verts, double step,
+		  ThreadPool* pPool = 0);
+	~SimThread();
+
+	//Writes the blended positions into verts, which must have one vertex
+	//per planetoid, and returns the orbital time they stand for. Call from
+	//the render thread only.
+	double Interpolate(Vertex* verts);
+
+	//Orbital seconds per wall second, negative to rewind
+	void SetTimeWarp(double warp)
+	{
+		m_warp.store(warp);
+	}
+
+	double GetTimeWarp() const
+	{
+		return m_warp.load();
+	}
+
+	//Orbital time of the newest state
+	double GetTime() const
+	{
+		return m_time.load();
+	}
+
+	//Jumps the orbital time by seconds on the next step
+	void Scrub(double seconds);
+private:
+	void Run();
+
+	PlanetoidStore* m_pStore;
+	ThreadPool* m_pPool;
+	TripleBuffer<SimFrame> m_frames;
+	std::vector<Vertex> m_last; //State of the last step, for the next prev
+	std::chrono::steady_clock::duration m_step;
+	double m_stepsecs;
+	std::atomic<double> m_warp, m_scrub, m_time;
+	std::atomic<bool> m_bQuit;
+	MemCounter m_mem;
+	std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,176 @@
+#include "snapshot.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static size_t AlignUp(size_t n)
+{
+	return (n + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN;
+}
+
+void SnapshotWriter::AddColumn(uint32_t id, const void* data, size_t elemsize, size_t count)
+{
+	SnapshotColumn column;
+	column.id = id;
+	column.elemsize = elemsize;
+	column.count = count;
+	column.offset = 0;
+	m_columns.push_back(column);
+	m_data.push_back(data);
+}
+
+bool SnapshotWriter::Write(const char* path, double time, unsigned long long seed) const
+{
+	SnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	header.version = SNAPSHOT_VERSION;
+	header.columns = m_columns.size();
+	header.time = time;
+	header.seed = seed;
+
+	//Offsets are known before anything is written
+	std::vector<SnapshotColumn> columns(m_columns);
+	size_t offset = AlignUp(sizeof(header) + columns.size() * sizeof(SnapshotColumn));
+	for(SnapshotColumn& column : columns)
+	{
+		column.offset = offset;
+		offset = AlignUp(offset + column.elemsize * column.count);
+	}
+
+	//Written beside the target and renamed over it once complete, so a
+	//failed save leaves the last good snapshot in place
+	std::string temp = std::string(path) + ".tmp";
+	FILE* fp = fopen(temp.c_str(), "wb");
+	if(!fp)
+	{
+		fprintf(stderr, "Cannot write snapshot %s\n", temp.c_str());
+		return false;
+	}
+	static const char padding[SNAPSHOT_ALIGN] = {0};
+	size_t written = fwrite(&header, sizeof(header), 1, fp) * sizeof(header);
+	if(!columns.empty())
+	{
+		written += fwrite(&columns[0], sizeof(SnapshotColumn), columns.size(), fp) * sizeof(SnapshotColumn);
+	}
+	bool bOk = written == sizeof(header) + columns.size() * sizeof(SnapshotColumn);
+	for(size_t i = 0; i < columns.size() && bOk; ++i)
+	{
+		written += fwrite(padding, 1, columns[i].offset - written, fp);
+		size_t bytes = columns[i].elemsize * columns[i].count;
+		if(bytes)
+		{
+			written += fwrite(m_data[i], 1, bytes, fp);
+		}
+		bOk = written == columns[i].offset + bytes;
+	}
+	bOk = fclose(fp) == 0 && bOk;
+	if(!bOk)
+	{
+		fprintf(stderr, "Failed writing snapshot %s\n", temp.c_str());
+		remove(temp.c_str());
+		return false;
+	}
+	if(rename(temp.c_str(), path))
+	{
+		fprintf(stderr, "Cannot replace snapshot %s\n", path);
+		remove(temp.c_str());
+		return false;
+	}
+	return true;
+}
+
+SnapshotReader::SnapshotReader() :
+	m_pMap(0),
+	m_size(0),
+	m_pHeader(0),
+	m_pColumns(0)
+{
+}
+
+SnapshotReader::~SnapshotReader()
+{
+	if(m_pMap)
+	{
+		munmap(const_cast<char*>(m_pMap), m_size);
+	}
+}
+
+bool SnapshotReader::Open(const char* path)
+{
+	int fd = open(path, O_RDONLY);
+	if(fd < 0)
+	{
+		fprintf(stderr, "Cannot open snapshot %s\n", path);
+		return false;
+	}
+	struct stat st;
+	void* pMap = MAP_FAILED;
+	if(fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(SnapshotHeader))
+	{
+		pMap = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if(pMap == MAP_FAILED)
+	{
+		fprintf(stderr, "Cannot map snapshot %s\n", path);
+		return false;
+	}
+	//Columns are read front to back as they upload
+	madvise(pMap, st.st_size, MADV_SEQUENTIAL);
+	m_pMap = static_cast<const char*>(pMap);
+	m_size = st.st_size;
+	m_pHeader = reinterpret_cast<const SnapshotHeader*>(m_pMap);
+	m_pColumns = reinterpret_cast<const SnapshotColumn*>(m_pMap + sizeof(SnapshotHeader));
+
+	const char* error = 0;
+	if(memcmp(m_pHeader->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)))
+	{
+		error = "not a snapshot";
+	}
+	else if(m_pHeader->version > SNAPSHOT_VERSION)
+	{
+		error = "newer version";
+	}
+	else if((m_size - sizeof(SnapshotHeader)) / sizeof(SnapshotColumn) < m_pHeader->columns)
+	{
+		error = "truncated directory";
+	}
+	for(uint32_t i = 0; !error && i < m_pHeader->columns; ++i)
+	{
+		const SnapshotColumn& column = m_pColumns[i];
+		if(column.offset % SNAPSHOT_ALIGN || column.offset > m_size ||
+		   (column.elemsize && column.count > (m_size - column.offset) / column.elemsize))
+		{
+			error = "column outside the file";
+		}
+	}
+	if(error)
+	{
+		fprintf(stderr, "Snapshot %s: %s\n", path, error);
+		munmap(pMap, m_size);
+		m_pMap = 0;
+		m_pHeader = 0;
+		m_pColumns = 0;
+		return false;
+	}
+	return true;
+}
+
+const void* SnapshotReader::GetColumn(uint32_t id, size_t elemsize, size_t* pCount) const
+{
+	for(uint32_t i = 0; m_pHeader && i < m_pHeader->columns; ++i)
+	{
+		if(m_pColumns[i].id == id && m_pColumns[i].elemsize == elemsize)
+		{
+			*pCount = m_pColumns[i].count;
+			return m_pMap + m_pColumns[i].offset;
+		}
+	}
+	*pCount = 0;
+	return 0;
+}
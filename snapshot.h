@@ -0,0 +1,98 @@
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#define SNAPSHOT_MAGIC "GLTSNAP"
+#define SNAPSHOT_VERSION 1
+//Every column starts on a multiple of this many bytes from the file start
+#define SNAPSHOT_ALIGN 64
+
+//Column ids. Ids are never reused, and readers skip the ones they do not
+//know, so newer files still load in part.
+enum SnapshotColumnId
+{
+	SNAPSHOT_STARS = 1, //Vertex per star, as in the VBO
+	SNAPSHOT_PLANETOIDS = 2, //Vertex per planetoid
+	SNAPSHOT_ORBITS = 3, //Vertex pairs of the orbit lines
+	SNAPSHOT_EDGES = 4, //Edge
+	SNAPSHOT_REMOVED = 5, //char per star, set when despawned
+	SNAPSHOT_TOPOLOGY = 6, //Two uint32_t: GraphTopology and its k
+	SNAPSHOT_SPAWNED = 7, //uint32_t star index per spawned star, oldest first
+	SNAPSHOT_PLANETOID_ORBITS = 16 //PLANETOID_COLUMNS ids of float from here
+};
+
+struct SnapshotHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t columns;
+	double time; //Simulation time when saved
+	uint64_t seed;
+};
+
+struct SnapshotColumn
+{
+	uint32_t id;
+	uint32_t elemsize;
+	uint64_t count;
+	uint64_t offset; //From the file start
+};
+
+//Builds a snapshot from columns borrowed from their owners and writes it
+//in one sequential pass: header, column directory, then the columns.
+class SnapshotWriter
+{
+public:
+	//data must stay valid until Write
+	void AddColumn(uint32_t id, const void* data, size_t elemsize, size_t count);
+
+	//Replaces path only once the whole file is written
+	bool Write(const char* path, double time, unsigned long long seed) const;
+private:
+	std::vector<SnapshotColumn> m_columns;
+	std::vector<const void*> m_data;
+};
+
+//Maps a snapshot read only. Columns are used in place, straight from the
+//mapping, and stay valid for the reader's life.
+class SnapshotReader
+{
+public:
+	SnapshotReader();
+	~SnapshotReader();
+
+	//Checks the header and that every column lies inside the file
+	bool Open(const char* path);
+
+	double GetTime() const
+	{
+		return m_pHeader->time;
+	}
+
+	unsigned long long GetSeed() const
+	{
+		return m_pHeader->seed;
+	}
+
+	//The column's elements, or null when it is absent or its elements are
+	//not elemsize bytes
+	const void* GetColumn(uint32_t id, size_t elemsize, size_t* pCount) const;
+
+	template<typename T>
+	const T* GetColumn(uint32_t id, size_t* pCount) const
+	{
+		return static_cast<const T*>(GetColumn(id, sizeof(T), pCount));
+	}
+private:
+	SnapshotReader(const SnapshotReader&) = delete;
+	SnapshotReader& operator=(const SnapshotReader&) = delete;
+
+	const char* m_pMap;
+	size_t m_size;
+	const SnapshotHeader* m_pHeader;
+	const SnapshotColumn* m_pColumns;
+};
+
+#endif
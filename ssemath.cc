@@ -6,3 +6,527 @@ void PrintQuat(float* quat, const char* str)
 {
 	printf("%10s: %f %f %f %f\n", str, quat[0], quat[1], quat[2], quat[3]);
 }
+
+//Sine and cosine reduce the angle by the nearest multiple of pi/2, taken in
+//three parts so the subtraction stays exact, and evaluate minimax
+//polynomials on [-pi/4, pi/4]. The quadrant swaps and negates the results.
+#define SINCOS_2_PI 0.636619772367581343f
+#define SINCOS_DP1 1.5703125f
+#define SINCOS_DP2 4.837512969970703125e-4f
+#define SINCOS_DP3 7.54978995489188216e-8f
+#define SINCOS_S0 -1.6666654611e-1f
+#define SINCOS_S1 8.3321608736e-3f
+#define SINCOS_S2 -1.9515295891e-4f
+#define SINCOS_C0 4.166664568298827e-2f
+#define SINCOS_C1 -1.388731625493765e-3f
+#define SINCOS_C2 2.443315711809948e-5f
+//Newton steps on Kepler's equation; from the starting guess below this
+//reaches float precision for eccentricities up to about 0.9
+#define KEPLER_ITERATIONS 4
+
+//Distances are summed as dx*dx + dy*dy + dz*dz without fusing, which with
+//-ffp-contract=off makes the SIMD and scalar paths agree bit for bit
+
+#if defined(__AVX512F__)
+
+void Distance2Batch(const float* px, const float* py, const float* pz, size_t count,
+		    float x, float y, float z, float* out)
+{
+	const __m512 vx = _mm512_set1_ps(x), vy = _mm512_set1_ps(y), vz = _mm512_set1_ps(z);
+	for(size_t i = 0; i < count; i += 16)
+	{
+		__mmask16 m = count - i >= 16 ? 0xFFFF : (__mmask16) ((1u << (count - i)) - 1);
+		__m512 dx = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, px + i), vx);
+		__m512 dy = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, py + i), vy);
+		__m512 dz = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, pz + i), vz);
+		__m512 d2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)),
+					 _mm512_mul_ps(dz, dz));
+		_mm512_mask_storeu_ps(out + i, m, d2);
+	}
+}
+
+long ArgMinDistance2(const float* px, const float* py, const float* pz, size_t count,
+		     float x, float y, float z, const uint32_t* labels,
+		     uint32_t skiplabel, float* bestd2)
+{
+	const __m512 vx = _mm512_set1_ps(x), vy = _mm512_set1_ps(y), vz = _mm512_set1_ps(z);
+	const __m512i skip = _mm512_set1_epi32(skiplabel), step = _mm512_set1_epi32(16);
+	__m512 best = _mm512_set1_ps(*bestd2);
+	__m512i bestidx = _mm512_set1_epi32(-1);
+	__m512i idx = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__mmask16 found = 0;
+	for(size_t i = 0; i < count; i += 16, idx = _mm512_add_epi32(idx, step))
+	{
+		__mmask16 m = count - i >= 16 ? 0xFFFF : (__mmask16) ((1u << (count - i)) - 1);
+		if(labels)
+		{
+			m = _mm512_mask_cmpneq_epi32_mask(m, _mm512_maskz_loadu_epi32(m, labels + i), skip);
+		}
+		__m512 dx = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, px + i), vx);
+		__m512 dy = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, py + i), vy);
+		__m512 dz = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, pz + i), vz);
+		__m512 d2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)),
+					 _mm512_mul_ps(dz, dz));
+		//A lane's first hit may equal the bound, later ones must beat it
+		__mmask16 take = _mm512_mask_cmp_ps_mask(m, d2, best, _CMP_LT_OQ) |
+			(_mm512_mask_cmp_ps_mask(m, d2, best, _CMP_EQ_OQ) & ~found);
+		best = _mm512_mask_blend_ps(take, best, d2);
+		bestidx = _mm512_mask_blend_epi32(take, bestidx, idx);
+		found |= take;
+	}
+	if(!found)
+	{
+		return -1;
+	}
+
+	float d2 = _mm512_mask_reduce_min_ps(found, best);
+	__mmask16 at = _mm512_mask_cmp_ps_mask(found, best, _mm512_set1_ps(d2), _CMP_EQ_OQ);
+	*bestd2 = d2;
+	return _mm512_mask_reduce_min_epi32(at, bestidx);
+}
+
+size_t BoxOverlapBatch(const float* miny, const float* maxy, const float* minz,
+		       const float* maxz, size_t count, float ylo, float yhi,
+		       float zlo, float zhi, uint32_t* out)
+{
+	const __m512 vylo = _mm512_set1_ps(ylo), vyhi = _mm512_set1_ps(yhi);
+	const __m512 vzlo = _mm512_set1_ps(zlo), vzhi = _mm512_set1_ps(zhi);
+	size_t written = 0;
+	for(size_t i = 0; i < count; i += 16)
+	{
+		__mmask16 m = count - i >= 16 ? 0xFFFF : (1u << (count - i)) - 1;
+		m = _mm512_mask_cmp_ps_mask(m, _mm512_maskz_loadu_ps(m, miny + i), vyhi, _CMP_LE_OQ);
+		m = _mm512_mask_cmp_ps_mask(m, _mm512_maskz_loadu_ps(m, maxy + i), vylo, _CMP_GE_OQ);
+		m = _mm512_mask_cmp_ps_mask(m, _mm512_maskz_loadu_ps(m, minz + i), vzhi, _CMP_LE_OQ);
+		m = _mm512_mask_cmp_ps_mask(m, _mm512_maskz_loadu_ps(m, maxz + i), vzlo, _CMP_GE_OQ);
+		for(unsigned int bits = m; bits; bits &= bits - 1)
+		{
+			out[written++] = i + __builtin_ctz(bits);
+		}
+	}
+	return written;
+}
+
+static inline void SinCos16(__m512 x, __m512* psin, __m512* pcos)
+{
+	const __m512i one = _mm512_set1_epi32(1), two = _mm512_set1_epi32(2);
+	__m512 j = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(SINCOS_2_PI)),
+					_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m512 r = _mm512_sub_ps(x, _mm512_mul_ps(j, _mm512_set1_ps(SINCOS_DP1)));
+	r = _mm512_sub_ps(r, _mm512_mul_ps(j, _mm512_set1_ps(SINCOS_DP2)));
+	r = _mm512_sub_ps(r, _mm512_mul_ps(j, _mm512_set1_ps(SINCOS_DP3)));
+	__m512i q = _mm512_cvtps_epi32(j);
+	__m512 z = _mm512_mul_ps(r, r);
+
+	__m512 ps = _mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(SINCOS_S2), z), _mm512_set1_ps(SINCOS_S1));
+	ps = _mm512_add_ps(_mm512_mul_ps(ps, z), _mm512_set1_ps(SINCOS_S0));
+	ps = _mm512_add_ps(_mm512_mul_ps(_mm512_mul_ps(ps, z), r), r);
+	__m512 pc = _mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(SINCOS_C2), z), _mm512_set1_ps(SINCOS_C1));
+	pc = _mm512_add_ps(_mm512_mul_ps(pc, z), _mm512_set1_ps(SINCOS_C0));
+	pc = _mm512_add_ps(_mm512_mul_ps(_mm512_mul_ps(pc, z), z),
+			   _mm512_sub_ps(_mm512_set1_ps(1.f), _mm512_mul_ps(z, _mm512_set1_ps(0.5f))));
+
+	__mmask16 swap = _mm512_test_epi32_mask(q, one);
+	__m512 s = _mm512_mask_blend_ps(swap, ps, pc);
+	__m512 c = _mm512_mask_blend_ps(swap, pc, ps);
+	__m512i ssign = _mm512_slli_epi32(_mm512_and_si512(q, two), 30);
+	__m512i csign = _mm512_slli_epi32(_mm512_and_si512(_mm512_add_epi32(q, one), two), 30);
+	*psin = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(s), ssign));
+	*pcos = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(c), csign));
+}
+
+void KeplerBatch(const float* mean, const float* e, size_t count, float* sin, float* cos)
+{
+	const __m512 start = _mm512_set1_ps(0.85f), one = _mm512_set1_ps(1.f), half = _mm512_set1_ps(0.5f);
+	//Each step runs over the whole batch, keeping the anomalies in sin,
+	//so independent lanes overlap instead of waiting on one long chain
+	for(size_t i = 0; i < count; i += 16)
+	{
+		__mmask16 m = count - i >= 16 ? 0xFFFF : (__mmask16) ((1u << (count - i)) - 1);
+		__m512 vm = _mm512_maskz_loadu_ps(m, mean + i), ve = _mm512_maskz_loadu_ps(m, e + i);
+		//Start on the side of the mean anomaly's sign, which always converges
+		__m512 ecc = _mm512_mul_ps(ve, start);
+		__mmask16 neg = _mm512_cmp_ps_mask(vm, _mm512_setzero_ps(), _CMP_LT_OQ);
+		_mm512_mask_storeu_ps(sin + i, m, _mm512_add_ps(vm, _mm512_mask_sub_ps(ecc, neg, _mm512_setzero_ps(), ecc)));
+	}
+	for(int k = 0; k < KEPLER_ITERATIONS; ++k)
+	{
+		bool bLast = k == KEPLER_ITERATIONS - 1;
+		for(size_t i = 0; i < count; i += 16)
+		{
+			__mmask16 m = count - i >= 16 ? 0xFFFF : (__mmask16) ((1u << (count - i)) - 1);
+			__m512 vm = _mm512_maskz_loadu_ps(m, mean + i), ve = _mm512_maskz_loadu_ps(m, e + i);
+			__m512 ea = _mm512_maskz_loadu_ps(m, sin + i);
+			__m512 s, c;
+			SinCos16(ea, &s, &c);
+			__m512 f = _mm512_sub_ps(_mm512_sub_ps(ea, _mm512_mul_ps(ve, s)), vm);
+			__m512 d = _mm512_div_ps(f, _mm512_sub_ps(one, _mm512_mul_ps(ve, c)));
+			if(!bLast)
+			{
+				_mm512_mask_storeu_ps(sin + i, m, _mm512_sub_ps(ea, d));
+				continue;
+			}
+			//The last step is small enough to rotate the sine and cosine
+			//through it with a second order expansion
+			__m512 keep = _mm512_sub_ps(one, _mm512_mul_ps(_mm512_mul_ps(d, d), half));
+			_mm512_mask_storeu_ps(sin + i, m, _mm512_sub_ps(_mm512_mul_ps(s, keep), _mm512_mul_ps(c, d)));
+			_mm512_mask_storeu_ps(cos + i, m, _mm512_add_ps(_mm512_mul_ps(c, keep), _mm512_mul_ps(s, d)));
+		}
+	}
+}
+
+void GravityBatch(const float* px, const float* py, const float* pz, const float* pm,
+		  size_t count, float x, float y, float z, float eps2, float* acc)
+{
+	const __m512 vx = _mm512_set1_ps(x), vy = _mm512_set1_ps(y), vz = _mm512_set1_ps(z);
+	const __m512 veps = _mm512_set1_ps(eps2), half = _mm512_set1_ps(0.5f), threehalves = _mm512_set1_ps(1.5f);
+	__m512 ax = _mm512_setzero_ps(), ay = _mm512_setzero_ps(), az = _mm512_setzero_ps();
+	for(size_t i = 0; i < count; i += 16)
+	{
+		__mmask16 m = count - i >= 16 ? 0xFFFF : (__mmask16) ((1u << (count - i)) - 1);
+		__m512 dx = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, px + i), vx);
+		__m512 dy = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, py + i), vy);
+		__m512 dz = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, pz + i), vz);
+		__m512 r2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)),
+					 _mm512_add_ps(_mm512_mul_ps(dz, dz), veps));
+		//Reciprocal square root estimate refined by one Newton step
+		__m512 inv = _mm512_rsqrt14_ps(r2);
+		inv = _mm512_mul_ps(inv, _mm512_sub_ps(threehalves, _mm512_mul_ps(_mm512_mul_ps(half, r2),
+										   _mm512_mul_ps(inv, inv))));
+		__m512 s = _mm512_mul_ps(_mm512_maskz_loadu_ps(m, pm + i), _mm512_mul_ps(inv, _mm512_mul_ps(inv, inv)));
+		ax = _mm512_add_ps(ax, _mm512_mul_ps(s, dx));
+		ay = _mm512_add_ps(ay, _mm512_mul_ps(s, dy));
+		az = _mm512_add_ps(az, _mm512_mul_ps(s, dz));
+	}
+	acc[0] += _mm512_reduce_add_ps(ax);
+	acc[1] += _mm512_reduce_add_ps(ay);
+	acc[2] += _mm512_reduce_add_ps(az);
+}
+
+#elif defined(__AVX2__)
+
+static inline __m256i TailMask(size_t remaining)
+{
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	return _mm256_cmpgt_epi32(_mm256_set1_epi32(remaining < 8 ? remaining : 8), lanes);
+}
+
+void Distance2Batch(const float* px, const float* py, const float* pz, size_t count,
+		    float x, float y, float z, float* out)
+{
+	const __m256 vx = _mm256_set1_ps(x), vy = _mm256_set1_ps(y), vz = _mm256_set1_ps(z);
+	size_t i = 0;
+	for(; i + 8 <= count; i += 8)
+	{
+		__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(px + i), vx);
+		__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(py + i), vy);
+		__m256 dz = _mm256_sub_ps(_mm256_loadu_ps(pz + i), vz);
+		__m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+					 _mm256_mul_ps(dz, dz));
+		_mm256_storeu_ps(out + i, d2);
+	}
+	if(i < count)
+	{
+		__m256i m = TailMask(count - i);
+		__m256 dx = _mm256_sub_ps(_mm256_maskload_ps(px + i, m), vx);
+		__m256 dy = _mm256_sub_ps(_mm256_maskload_ps(py + i, m), vy);
+		__m256 dz = _mm256_sub_ps(_mm256_maskload_ps(pz + i, m), vz);
+		__m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+					 _mm256_mul_ps(dz, dz));
+		_mm256_maskstore_ps(out + i, m, d2);
+	}
+}
+
+long ArgMinDistance2(const float* px, const float* py, const float* pz, size_t count,
+		     float x, float y, float z, const uint32_t* labels,
+		     uint32_t skiplabel, float* bestd2)
+{
+	const __m256 vx = _mm256_set1_ps(x), vy = _mm256_set1_ps(y), vz = _mm256_set1_ps(z);
+	const __m256i skip = _mm256_set1_epi32(skiplabel), step = _mm256_set1_epi32(8);
+	__m256 best = _mm256_set1_ps(*bestd2);
+	__m256i bestidx = _mm256_set1_epi32(-1);
+	__m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256 found = _mm256_setzero_ps();
+	for(size_t i = 0; i < count; i += 8, idx = _mm256_add_epi32(idx, step))
+	{
+		__m256i m = TailMask(count - i);
+		if(labels)
+		{
+			__m256i same = _mm256_cmpeq_epi32(_mm256_maskload_epi32((const int*) labels + i, m), skip);
+			m = _mm256_andnot_si256(same, m);
+		}
+		__m256 valid = _mm256_castsi256_ps(m);
+		__m256 dx = _mm256_sub_ps(_mm256_maskload_ps(px + i, m), vx);
+		__m256 dy = _mm256_sub_ps(_mm256_maskload_ps(py + i, m), vy);
+		__m256 dz = _mm256_sub_ps(_mm256_maskload_ps(pz + i, m), vz);
+		__m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+					 _mm256_mul_ps(dz, dz));
+		//A lane's first hit may equal the bound, later ones must beat it
+		__m256 take = _mm256_or_ps(_mm256_cmp_ps(d2, best, _CMP_LT_OQ),
+					   _mm256_andnot_ps(found, _mm256_cmp_ps(d2, best, _CMP_EQ_OQ)));
+		take = _mm256_and_ps(take, valid);
+		best = _mm256_blendv_ps(best, d2, take);
+		bestidx = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(bestidx),
+							       _mm256_castsi256_ps(idx), take));
+		found = _mm256_or_ps(found, take);
+	}
+	int foundmask = _mm256_movemask_ps(found);
+	if(!foundmask)
+	{
+		return -1;
+	}
+
+	//Horizontal minimum, then the lowest position holding it
+	__m256 lanes = _mm256_blendv_ps(_mm256_set1_ps(INFINITY), best, found);
+	__m256 mn = _mm256_min_ps(lanes, _mm256_permute2f128_ps(lanes, lanes, 1));
+	mn = _mm256_min_ps(mn, _mm256_shuffle_ps(mn, mn, _MM_SHUFFLE(1, 0, 3, 2)));
+	mn = _mm256_min_ps(mn, _mm256_shuffle_ps(mn, mn, _MM_SHUFFLE(2, 3, 0, 1)));
+	int at = _mm256_movemask_ps(_mm256_cmp_ps(lanes, mn, _CMP_EQ_OQ)) & foundmask;
+
+	alignas(32) int32_t indices[8];
+	_mm256_store_si256((__m256i*) indices, bestidx);
+	long result = -1;
+	for(int lane = 0; lane < 8; ++lane)
+	{
+		if((at >> lane) & 1 && (result < 0 || indices[lane] < result))
+		{
+			result = indices[lane];
+		}
+	}
+	*bestd2 = _mm256_cvtss_f32(mn);
+	return result;
+}
+
+size_t BoxOverlapBatch(const float* miny, const float* maxy, const float* minz,
+		       const float* maxz, size_t count, float ylo, float yhi,
+		       float zlo, float zhi, uint32_t* out)
+{
+	const __m256 vylo = _mm256_set1_ps(ylo), vyhi = _mm256_set1_ps(yhi);
+	const __m256 vzlo = _mm256_set1_ps(zlo), vzhi = _mm256_set1_ps(zhi);
+	size_t written = 0;
+	for(size_t i = 0; i < count; i += 8)
+	{
+		__m256i m = TailMask(count - i);
+		__m256 hit = _mm256_and_ps(_mm256_cmp_ps(_mm256_maskload_ps(miny + i, m), vyhi, _CMP_LE_OQ),
+					   _mm256_cmp_ps(_mm256_maskload_ps(maxy + i, m), vylo, _CMP_GE_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_maskload_ps(minz + i, m), vzhi, _CMP_LE_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_maskload_ps(maxz + i, m), vzlo, _CMP_GE_OQ));
+		hit = _mm256_and_ps(hit, _mm256_castsi256_ps(m));
+		for(unsigned int bits = _mm256_movemask_ps(hit); bits; bits &= bits - 1)
+		{
+			out[written++] = i + __builtin_ctz(bits);
+		}
+	}
+	return written;
+}
+
+static inline void SinCos8(__m256 x, __m256* psin, __m256* pcos)
+{
+	const __m256i one = _mm256_set1_epi32(1), two = _mm256_set1_epi32(2);
+	__m256 j = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(SINCOS_2_PI)),
+				   _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256 r = _mm256_sub_ps(x, _mm256_mul_ps(j, _mm256_set1_ps(SINCOS_DP1)));
+	r = _mm256_sub_ps(r, _mm256_mul_ps(j, _mm256_set1_ps(SINCOS_DP2)));
+	r = _mm256_sub_ps(r, _mm256_mul_ps(j, _mm256_set1_ps(SINCOS_DP3)));
+	__m256i q = _mm256_cvtps_epi32(j);
+	__m256 z = _mm256_mul_ps(r, r);
+
+	__m256 ps = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(SINCOS_S2), z), _mm256_set1_ps(SINCOS_S1));
+	ps = _mm256_add_ps(_mm256_mul_ps(ps, z), _mm256_set1_ps(SINCOS_S0));
+	ps = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(ps, z), r), r);
+	__m256 pc = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(SINCOS_C2), z), _mm256_set1_ps(SINCOS_C1));
+	pc = _mm256_add_ps(_mm256_mul_ps(pc, z), _mm256_set1_ps(SINCOS_C0));
+	pc = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(pc, z), z),
+			   _mm256_sub_ps(_mm256_set1_ps(1.f), _mm256_mul_ps(z, _mm256_set1_ps(0.5f))));
+
+	__m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(q, one), one));
+	__m256 s = _mm256_blendv_ps(ps, pc, swap);
+	__m256 c = _mm256_blendv_ps(pc, ps, swap);
+	__m256 ssign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(q, two), 30));
+	__m256 csign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(q, one), two), 30));
+	*psin = _mm256_xor_ps(s, ssign);
+	*pcos = _mm256_xor_ps(c, csign);
+}
+
+void KeplerBatch(const float* mean, const float* e, size_t count, float* sin, float* cos)
+{
+	const __m256 start = _mm256_set1_ps(0.85f), one = _mm256_set1_ps(1.f), half = _mm256_set1_ps(0.5f);
+	//Each step runs over the whole batch, keeping the anomalies in sin,
+	//so independent lanes overlap instead of waiting on one long chain
+	for(size_t i = 0; i < count; i += 8)
+	{
+		__m256i m = TailMask(count - i);
+		__m256 vm = _mm256_maskload_ps(mean + i, m), ve = _mm256_maskload_ps(e + i, m);
+		//Start on the side of the mean anomaly's sign, which always converges
+		__m256 ecc = _mm256_mul_ps(ve, start);
+		__m256 neg = _mm256_cmp_ps(vm, _mm256_setzero_ps(), _CMP_LT_OQ);
+		_mm256_maskstore_ps(sin + i, m, _mm256_add_ps(vm, _mm256_blendv_ps(ecc, _mm256_sub_ps(_mm256_setzero_ps(), ecc), neg)));
+	}
+	for(int k = 0; k < KEPLER_ITERATIONS; ++k)
+	{
+		bool bLast = k == KEPLER_ITERATIONS - 1;
+		for(size_t i = 0; i < count; i += 8)
+		{
+			__m256i m = TailMask(count - i);
+			__m256 vm = _mm256_maskload_ps(mean + i, m), ve = _mm256_maskload_ps(e + i, m);
+			__m256 ea = _mm256_maskload_ps(sin + i, m);
+			__m256 s, c;
+			SinCos8(ea, &s, &c);
+			__m256 f = _mm256_sub_ps(_mm256_sub_ps(ea, _mm256_mul_ps(ve, s)), vm);
+			__m256 d = _mm256_div_ps(f, _mm256_sub_ps(one, _mm256_mul_ps(ve, c)));
+			if(!bLast)
+			{
+				_mm256_maskstore_ps(sin + i, m, _mm256_sub_ps(ea, d));
+				continue;
+			}
+			//The last step is small enough to rotate the sine and cosine
+			//through it with a second order expansion
+			__m256 keep = _mm256_sub_ps(one, _mm256_mul_ps(_mm256_mul_ps(d, d), half));
+			_mm256_maskstore_ps(sin + i, m, _mm256_sub_ps(_mm256_mul_ps(s, keep), _mm256_mul_ps(c, d)));
+			_mm256_maskstore_ps(cos + i, m, _mm256_add_ps(_mm256_mul_ps(c, keep), _mm256_mul_ps(s, d)));
+		}
+	}
+}
+
+static inline float HorizontalSum(__m256 v)
+{
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
+
+void GravityBatch(const float* px, const float* py, const float* pz, const float* pm,
+		  size_t count, float x, float y, float z, float eps2, float* acc)
+{
+	const __m256 vx = _mm256_set1_ps(x), vy = _mm256_set1_ps(y), vz = _mm256_set1_ps(z);
+	const __m256 veps = _mm256_set1_ps(eps2), half = _mm256_set1_ps(0.5f), threehalves = _mm256_set1_ps(1.5f);
+	__m256 ax = _mm256_setzero_ps(), ay = _mm256_setzero_ps(), az = _mm256_setzero_ps();
+	for(size_t i = 0; i < count; i += 8)
+	{
+		__m256i m = TailMask(count - i);
+		__m256 dx = _mm256_sub_ps(_mm256_maskload_ps(px + i, m), vx);
+		__m256 dy = _mm256_sub_ps(_mm256_maskload_ps(py + i, m), vy);
+		__m256 dz = _mm256_sub_ps(_mm256_maskload_ps(pz + i, m), vz);
+		__m256 r2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+					 _mm256_add_ps(_mm256_mul_ps(dz, dz), veps));
+		//Reciprocal square root estimate refined by one Newton step
+		__m256 inv = _mm256_rsqrt_ps(r2);
+		inv = _mm256_mul_ps(inv, _mm256_sub_ps(threehalves, _mm256_mul_ps(_mm256_mul_ps(half, r2),
+										   _mm256_mul_ps(inv, inv))));
+		//Masked lanes load zero mass and so add nothing
+		__m256 s = _mm256_mul_ps(_mm256_maskload_ps(pm + i, m), _mm256_mul_ps(inv, _mm256_mul_ps(inv, inv)));
+		ax = _mm256_add_ps(ax, _mm256_mul_ps(s, dx));
+		ay = _mm256_add_ps(ay, _mm256_mul_ps(s, dy));
+		az = _mm256_add_ps(az, _mm256_mul_ps(s, dz));
+	}
+	acc[0] += HorizontalSum(ax);
+	acc[1] += HorizontalSum(ay);
+	acc[2] += HorizontalSum(az);
+}
+
+#else
+
+void Distance2Batch(const float* px, const float* py, const float* pz, size_t count,
+		    float x, float y, float z, float* out)
+{
+	for(size_t i = 0; i < count; ++i)
+	{
+		float dx = px[i] - x, dy = py[i] - y, dz = pz[i] - z;
+		out[i] = dx * dx + dy * dy + dz * dz;
+	}
+}
+
+long ArgMinDistance2(const float* px, const float* py, const float* pz, size_t count,
+		     float x, float y, float z, const uint32_t* labels,
+		     uint32_t skiplabel, float* bestd2)
+{
+	long best = -1;
+	for(size_t i = 0; i < count; ++i)
+	{
+		if(labels && labels[i] == skiplabel)
+		{
+			continue;
+		}
+		float dx = px[i] - x, dy = py[i] - y, dz = pz[i] - z;
+		float d2 = dx * dx + dy * dy + dz * dz;
+		if(d2 < *bestd2 || (best < 0 && d2 == *bestd2))
+		{
+			*bestd2 = d2;
+			best = i;
+		}
+	}
+	return best;
+}
+
+size_t BoxOverlapBatch(const float* miny, const float* maxy, const float* minz,
+		       const float* maxz, size_t count, float ylo, float yhi,
+		       float zlo, float zhi, uint32_t* out)
+{
+	size_t written = 0;
+	for(size_t i = 0; i < count; ++i)
+	{
+		if(miny[i] <= yhi && maxy[i] >= ylo && minz[i] <= zhi && maxz[i] >= zlo)
+		{
+			out[written++] = i;
+		}
+	}
+	return written;
+}
+
+static inline void SinCos1(float x, float* psin, float* pcos)
+{
+	float j = nearbyintf(x * SINCOS_2_PI);
+	float r = x - j * SINCOS_DP1;
+	r = r - j * SINCOS_DP2;
+	r = r - j * SINCOS_DP3;
+	int q = (int) j;
+	float z = r * r;
+	float ps = ((SINCOS_S2 * z + SINCOS_S1) * z + SINCOS_S0) * z * r + r;
+	float pc = ((SINCOS_C2 * z + SINCOS_C1) * z + SINCOS_C0) * z * z + (1.f - z * 0.5f);
+	float s = q & 1 ? pc : ps, c = q & 1 ? ps : pc;
+	*psin = q & 2 ? -s : s;
+	*pcos = (q + 1) & 2 ? -c : c;
+}
+
+void KeplerBatch(const float* mean, const float* e, size_t count, float* sin, float* cos)
+{
+	for(size_t i = 0; i < count; ++i)
+	{
+		//Start on the side of the mean anomaly's sign, which always converges
+		float ea = mean[i] + (mean[i] < 0.f ? -(e[i] * 0.85f) : e[i] * 0.85f);
+		float s = 0.f, c = 1.f, d = 0.f;
+		for(int k = 0; k < KEPLER_ITERATIONS; ++k)
+		{
+			SinCos1(ea, &s, &c);
+			d = ((ea - e[i] * s) - mean[i]) / (1.f - e[i] * c);
+			ea = ea - d;
+		}
+		//The last step is small enough to rotate the sine and cosine
+		//through it with a second order expansion
+		float keep = 1.f - d * d * 0.5f;
+		sin[i] = s * keep - c * d;
+		cos[i] = c * keep + s * d;
+	}
+}
+
+void GravityBatch(const float* px, const float* py, const float* pz, const float* pm,
+		  size_t count, float x, float y, float z, float eps2, float* acc)
+{
+	float ax = 0.f, ay = 0.f, az = 0.f;
+	for(size_t i = 0; i < count; ++i)
+	{
+		float dx = px[i] - x, dy = py[i] - y, dz = pz[i] - z;
+		float r2 = dx * dx + dy * dy + (dz * dz + eps2);
+		float inv = 1.f / sqrtf(r2);
+		float s = pm[i] * (inv * inv * inv);
+		ax += s * dx;
+		ay += s * dy;
+		az += s * dz;
+	}
+	acc[0] += ax;
+	acc[1] += ay;
+	acc[2] += az;
+}
+
+#endif
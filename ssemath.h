@@ -2,6 +2,8 @@
 #define SSEMATH_H_
 #include <immintrin.h>
 #include <smmintrin.h>
+#include <cstddef>
+#include <cstdint>
 #define qx(q) q[0]
 #define qy(q) q[1]
 #define qz(q) q[2]
@@ -9,6 +11,38 @@
 
 void PrintQuat(float* quat, const char* str);
 
+//Squared distances from (x, y, z) to count points stored as separate x, y
+//and z arrays, 16 at a time with AVX-512 or 8 with AVX2
+void Distance2Batch(const float* px, const float* py, const float* pz, size_t count,
+		    float x, float y, float z, float* out);
+
+//Position of the point nearest to (x, y, z) among count SoA points, only
+//considering those no farther than *bestd2 and, when labels is given,
+//whose label differs from skiplabel. Ties go to the lowest position.
+//Returns -1 if no point qualifies, otherwise lowers *bestd2 to its distance.
+long ArgMinDistance2(const float* px, const float* py, const float* pz, size_t count,
+		     float x, float y, float z, const uint32_t* labels,
+		     uint32_t skiplabel, float* bestd2);
+
+//Positions of the boxes among count, stored as separate min and max arrays
+//for y and z, that overlap [ylo, yhi] x [zlo, zhi], touching included.
+//Returns how many were written to out.
+size_t BoxOverlapBatch(const float* miny, const float* maxy, const float* minz,
+		       const float* maxz, size_t count, float ylo, float yhi,
+		       float zlo, float zhi, uint32_t* out);
+
+//Sine and cosine of the eccentric anomaly E solving Kepler's equation
+//E - e sin E = M for count mean anomalies M in [-pi, pi] and
+//eccentricities e below 1, by Newton iteration in every lane at once
+void KeplerBatch(const float* mean, const float* e, size_t count, float* sin, float* cos);
+
+//Gravitational acceleration (G = 1) at (x, y, z) from count point masses
+//stored as separate x, y, z and mass arrays, each softened by eps2 as
+//m d / (|d|^2 + eps2)^1.5, added into acc[0..2]. A mass at (x, y, z)
+//itself contributes nothing.
+void GravityBatch(const float* px, const float* py, const float* pz, const float* pm,
+		  size_t count, float x, float y, float z, float eps2, float* acc);
+
 inline __m128 SSECrossProduct(__m128 vec_a, __m128 vec_b)
 {
 	__m128 sh_a = _mm_shuffle_ps(vec_a, vec_a, _MM_SHUFFLE(3, 0, 2, 1));
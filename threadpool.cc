@@ -0,0 +1,233 @@
+#include "threadpool.h"
+#include <algorithm>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+//Pool and deque of the current thread, if it is a worker
+static thread_local ThreadPool* t_pPool = 0;
+static thread_local unsigned int t_queue = 0;
+
+ThreadPool::ThreadPool(unsigned int threads, bool bPinThreads) :
+	m_queued(0),
+	m_bQuit(false)
+{
+	if(!threads)
+	{
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	for(unsigned int i = 0; i < threads; ++i)
+	{
+		m_queues.emplace_back(new Queue);
+	}
+	for(unsigned int i = 1; i < threads; ++i)
+	{
+		m_workers.emplace_back(&ThreadPool::WorkerLoop, this, i - 1, bPinThreads);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_bQuit = true;
+	}
+	m_wake.notify_all();
+	for(std::thread& worker : m_workers)
+	{
+		worker.join();
+	}
+}
+
+void ThreadPool::WorkerLoop(unsigned int index, bool bPin)
+{
+#ifdef __linux__
+	if(bPin)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(index % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	}
+#endif
+	t_pPool = this;
+	t_queue = index;
+	for(;;)
+	{
+		if(RunOne())
+		{
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_wake.wait(lock, [this]
+			    {
+				    return m_bQuit || m_queued.load() > 0;
+			    });
+		if(m_bQuit && !m_queued.load())
+		{
+			return;
+		}
+	}
+}
+
+void ThreadPool::Push(std::function<void()> task)
+{
+	Queue& queue = *m_queues[t_pPool == this ? t_queue : m_queues.size() - 1];
+	//Counted first so the count never falls below the tasks queued
+	m_queued.fetch_add(1);
+	{
+		std::lock_guard<std::mutex> lock(queue.lock);
+		queue.tasks.push_back(std::move(task));
+	}
+	//Taking the lock orders this against a worker about to sleep
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+	}
+	m_wake.notify_one();
+}
+
+bool ThreadPool::RunOne()
+{
+	size_t count = m_queues.size();
+	size_t own = t_pPool == this ? t_queue : count - 1;
+	std::function<void()> task;
+	for(size_t k = 0; k < count && !task; ++k)
+	{
+		Queue& queue = *m_queues[(own + k) % count];
+		std::lock_guard<std::mutex> lock(queue.lock);
+		if(queue.tasks.empty())
+		{
+			continue;
+		}
+		//Own work newest first while it is hot in cache; stolen work oldest
+		//first, which for split ranges is the biggest piece
+		if(k == 0)
+		{
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		else
+		{
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+	}
+	if(!task)
+	{
+		return false;
+	}
+	m_queued.fetch_sub(1);
+	task();
+	return true;
+}
+
+void ThreadPool::RunRange(Range* pRange, size_t first, size_t last)
+{
+	//Halves are left for thieves until one chunk remains
+	while(last - first > 1)
+	{
+		size_t mid = first + (last - first) / 2;
+		Push([this, pRange, mid, last]
+		     {
+			     RunRange(pRange, mid, last);
+		     });
+		last = mid;
+	}
+	size_t lo = pRange->begin + first * pRange->grain;
+	(*pRange->pFn)(lo, std::min(lo + pRange->grain, pRange->end));
+	pRange->remaining.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void ThreadPool::ParallelFor(size_t begin, size_t end, size_t grain,
+			     const std::function<void(size_t, size_t)>& fn)
+{
+	if(begin >= end)
+	{
+		return;
+	}
+	grain = std::max<size_t>(grain, 1);
+
+	if(m_workers.empty() || end - begin <= grain)
+	{
+		for(size_t first = begin; first < end; first += grain)
+		{
+			fn(first, std::min(first + grain, end));
+		}
+		return;
+	}
+
+	Range range;
+	range.pFn = &fn;
+	range.begin = begin;
+	range.end = end;
+	range.grain = grain;
+	size_t chunks = (end - begin + grain - 1) / grain;
+	range.remaining.store(chunks);
+	RunRange(&range, 0, chunks);
+
+	//Queued chunks still point at range, so it cannot leave scope early
+	while(range.remaining.load(std::memory_order_acquire))
+	{
+		if(!RunOne())
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+void ThreadPool::Schedule(const TaskHandle& task)
+{
+	Push([this, task]
+	     {
+		     task->fn();
+		     task->fn = nullptr;
+		     std::vector<TaskHandle> dependents;
+		     {
+			     std::lock_guard<std::mutex> lock(task->lock);
+			     task->bDone.store(true);
+			     dependents.swap(task->dependents);
+		     }
+		     for(const TaskHandle& next : dependents)
+		     {
+			     if(next->waiting.fetch_sub(1) == 1)
+			     {
+				     Schedule(next);
+			     }
+		     }
+	     });
+}
+
+ThreadPool::TaskHandle ThreadPool::Submit(std::function<void()> fn, const std::vector<TaskHandle>& deps)
+{
+	TaskHandle task = std::make_shared<Task>();
+	task->fn = std::move(fn);
+	task->waiting.store(1);
+	task->bDone.store(false);
+	for(const TaskHandle& dep : deps)
+	{
+		std::lock_guard<std::mutex> lock(dep->lock);
+		if(!dep->bDone.load())
+		{
+			task->waiting.fetch_add(1);
+			dep->dependents.push_back(task);
+		}
+	}
+	if(task->waiting.fetch_sub(1) == 1)
+	{
+		Schedule(task);
+	}
+	return task;
+}
+
+void ThreadPool::Wait(const TaskHandle& task)
+{
+	while(!task->bDone.load())
+	{
+		if(!RunOne())
+		{
+			std::this_thread::yield();
+		}
+	}
+}
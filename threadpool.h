@@ -0,0 +1,82 @@
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+//Work-stealing pool of worker threads. Each worker keeps a deque of tasks,
+//running its own newest first and stealing the oldest from the others
+//when it runs dry; threads outside the pool share one more deque. Any
+//thread waiting on work, the caller of ParallelFor included, runs queued
+//tasks meanwhile, so parallel loops may nest freely.
+class ThreadPool
+{
+public:
+	struct Task;
+	typedef std::shared_ptr<Task> TaskHandle;
+
+	//threads counts the calling thread; 0 uses every hardware thread.
+	//bPinThreads binds worker i to core i.
+	ThreadPool(unsigned int threads = 0, bool bPinThreads = false);
+	~ThreadPool();
+
+	unsigned int GetThreadCount() const
+	{
+		return m_workers.size() + 1;
+	}
+
+	//Calls fn(first, last) for consecutive chunks of at most grain indices
+	//covering [begin, end) and returns once every chunk has finished.
+	//Chunks always start at begin plus a multiple of grain.
+	void ParallelFor(size_t begin, size_t end, size_t grain,
+			 const std::function<void(size_t, size_t)>& fn);
+
+	//Queues fn to run once every task in deps has finished. Without
+	//workers, queued tasks run when some thread waits.
+	TaskHandle Submit(std::function<void()> fn, const std::vector<TaskHandle>& deps = {});
+
+	//Runs queued tasks until task has finished
+	void Wait(const TaskHandle& task);
+
+	struct Task
+	{
+		std::function<void()> fn;
+		std::atomic<int> waiting; //Unfinished dependencies, plus one while submitting
+		std::mutex lock; //Guards dependents against the task finishing
+		std::vector<TaskHandle> dependents;
+		std::atomic<bool> bDone;
+	};
+private:
+	struct Queue
+	{
+		std::mutex lock;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	struct Range
+	{
+		const std::function<void(size_t, size_t)>* pFn;
+		size_t begin, end, grain;
+		std::atomic<size_t> remaining;
+	};
+
+	void WorkerLoop(unsigned int index, bool bPin);
+	void Push(std::function<void()> task);
+	bool RunOne();
+	void RunRange(Range* pRange, size_t first, size_t last);
+	void Schedule(const TaskHandle& task);
+
+	std::vector<std::thread> m_workers;
+	std::vector<std::unique_ptr<Queue>> m_queues; //One per worker, then the shared one
+	std::mutex m_lock;
+	std::condition_variable m_wake;
+	std::atomic<size_t> m_queued;
+	bool m_bQuit;
+};
+
+#endif